@@ -0,0 +1,419 @@
+/*
+ *  benchmark.c
+ *  SpotifySort
+ *
+ *  Runs the whole sort against containers written by gencontainer, on the
+ *  offline libspotify in fake/, and prints per-phase wall and CPU time and
+ *  peak RSS with the comparison and move counts as JSON. Given a baseline (an
+ *  earlier output of this program) it exits with status 2 if any phase of
+ *  any container got slower by more than the tolerance.
+ *
+ *    cc -std=gnu99 -O2 -pthread -I. -Ifake -o benchmark bench/benchmark.c \
+ *        playlist.c positions.c taskpool.c timing.c simcontainer.c trace.c \
+ *        progress.c fake/fakespotify.c
+ *
+ */
+
+#include <getopt.h>
+#include <libgen.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libspotify/api.h>
+
+#include "playlist.h"
+
+/// Phases faster than this never count as regressions; they are all noise
+#define MIN_REGRESSION_MS 5.0
+
+typedef struct s_bench_options {
+	sort_options sort;
+	int repeat;            // runs per container; the fastest of each phase counts
+	const char *baseline;  // earlier output to compare with
+	double tolerance;      // allowed slowdown, as a share of the baseline
+	const char *output;    // where to write the JSON; stdout by default
+	int check;             // check that each container comes out sorted
+} bench_options;
+
+static const char *engine_names[] = { "natural", "merge", "radix", "insert" };
+#define NUM_ENGINES ((int) (sizeof(engine_names) / sizeof(engine_names[0])))
+
+static const uint8_t g_dummy_key[] = { 0 };
+
+static int g_logged_in;
+static sp_error g_login_error;
+
+static void logged_in(sp_session *session, sp_error error) {
+	g_logged_in = 1;
+	g_login_error = error;
+}
+
+static sp_session_callbacks session_callbacks = {
+	.logged_in = &logged_in,
+};
+
+static sp_session_config spconfig = {
+	.api_version = SPOTIFY_API_VERSION,
+	.cache_location = "/tmp/spotifysort",
+	.settings_location = "/tmp/spotifysort",
+	.application_key = g_dummy_key,
+	.application_key_size = sizeof(g_dummy_key),
+	.user_agent = "SpotifySortBenchmark",
+	.callbacks = &session_callbacks,
+};
+
+static double ms(uint64_t ns) {
+	return ns / 1000000.0;
+}
+
+/** Running **/
+
+static const char *entry_name(sp_playlistcontainer *pc, int index) {
+	if(sp_playlistcontainer_playlist_type(pc, index) == SP_PLAYLIST_TYPE_START_FOLDER) {
+		return sp_playlistcontainer_playlist_folder_name(pc, index);
+	}
+	return sp_playlist_name(sp_playlistcontainer_playlist(pc, index));
+}
+
+/// Whether the children of every folder, and the top level, are in order by name
+static int check_sorted(sp_playlistcontainer *pc) {
+	int num_playlists = sp_playlistcontainer_num_playlists(pc);
+	int *previous, depth = 0, i, sorted = 1;
+	
+	// previous[d] is the index of the last entry seen d folders deep, -1 if none
+	previous = (int *) malloc(sizeof(int) * (num_playlists + 1));
+	if(previous == NULL) {
+		fprintf(stderr, "ERROR: out of memory\n");
+		return 0;
+	}
+	previous[0] = -1;
+	
+	for(i = 0; i < num_playlists && sorted; ++i) {
+		switch(sp_playlistcontainer_playlist_type(pc, i)) {
+			case SP_PLAYLIST_TYPE_PLAYLIST:
+			case SP_PLAYLIST_TYPE_START_FOLDER:
+				if(previous[depth] >= 0 && strcmp(entry_name(pc, previous[depth]), entry_name(pc, i)) > 0) {
+					sorted = 0;
+				}
+				previous[depth] = i;
+				if(sp_playlistcontainer_playlist_type(pc, i) == SP_PLAYLIST_TYPE_START_FOLDER) {
+					previous[++depth] = -1;
+				}
+				break;
+			case SP_PLAYLIST_TYPE_END_FOLDER:
+				--depth;
+				break;
+			default:
+				break;
+		}
+	}
+	
+	free(previous);
+	return sorted;
+}
+
+static int run_once(const char *container, const sort_options *options, int check, sort_report *report) {
+	sp_session *session;
+	sp_error error;
+	int next_timeout, sorted;
+	
+	setenv("FAKESPOTIFY_CONTAINER", container, 1);
+	
+	error = sp_session_create(&spconfig, &session);
+	if(error != SP_ERROR_OK) {
+		fprintf(stderr, "Unable to create session: %s\n", sp_error_message(error));
+		return 0;
+	}
+	
+	g_logged_in = 0;
+	sp_session_login(session, "benchmark", "none");
+	while(!g_logged_in) {
+		sp_session_process_events(session, &next_timeout);
+	}
+	if(g_login_error != SP_ERROR_OK) {
+		fprintf(stderr, "Cannot load %s: %s\n", container, sp_error_message(g_login_error));
+		sp_session_release(session);
+		return 0;
+	}
+	
+	sorted = sort_playlists(session, options, report);
+	if(sorted && check && !options->dry_run && !check_sorted(sp_session_playlistcontainer(session))) {
+		fprintf(stderr, "%s: not sorted after the run\n", container);
+		sorted = 0;
+	}
+	
+	sp_session_logout(session);
+	sp_session_release(session);
+	return sorted;
+}
+
+/// Run a container repeatedly, keeping the fastest time of each phase
+static int run_container(const char *container, const bench_options *options, sort_report *best) {
+	sort_report report;
+	int i, phase;
+	
+	for(i = 0; i < options->repeat; ++i) {
+		if(!run_once(container, &options->sort, options->check, &report)) {
+			return 0;
+		}
+		
+		if(i == 0) {
+			*best = report;
+			continue;
+		}
+		for(phase = 0; phase < NUM_SORT_PHASES; ++phase) {
+			if(report.phases[phase].wall_ns < best->phases[phase].wall_ns) {
+				best->phases[phase].wall_ns = report.phases[phase].wall_ns;
+			}
+			if(report.phases[phase].cpu_ns < best->phases[phase].cpu_ns) {
+				best->phases[phase].cpu_ns = report.phases[phase].cpu_ns;
+			}
+			if(report.phases[phase].peak_rss_kb > best->phases[phase].peak_rss_kb) {
+				best->phases[phase].peak_rss_kb = report.phases[phase].peak_rss_kb;
+			}
+		}
+	}
+	
+	return 1;
+}
+
+/** Output **/
+
+static void write_json_string(FILE *file, const char *s) {
+	fputc('"', file);
+	for(; *s != '\0'; ++s) {
+		if(*s == '"' || *s == '\\') {
+			fputc('\\', file);
+		}
+		fputc(*s, file);
+	}
+	fputc('"', file);
+}
+
+static void write_report(FILE *file, const char *container, const sort_report *report, int last) {
+	int phase;
+	
+	fprintf(file, "    {\n");
+	fprintf(file, "      \"container\": ");
+	write_json_string(file, container);
+	fprintf(file, ",\n");
+	fprintf(file, "      \"entries\": %d,\n", report->num_entries);
+	fprintf(file, "      \"folders\": %d,\n", report->num_folders);
+	fprintf(file, "      \"sorted_folders\": %d,\n", report->num_sorted_folders);
+	fprintf(file, "      \"comparisons\": %llu,\n", (unsigned long long) report->comparisons);
+	fprintf(file, "      \"prefix_comparisons\": %llu,\n", (unsigned long long) report->prefix_comparisons);
+	fprintf(file, "      \"moves\": %d,\n", report->num_moves);
+	fprintf(file, "      \"phases\": {\n");
+	for(phase = 0; phase < NUM_SORT_PHASES; ++phase) {
+		fprintf(file, "        ");
+		write_phase_json(file, sort_phase_names[phase], &report->phases[phase]);
+		fprintf(file, "%s\n", phase + 1 < NUM_SORT_PHASES ? "," : "");
+	}
+	fprintf(file, "      }\n");
+	fprintf(file, "    }%s\n", last ? "" : ",");
+}
+
+/** Baselines **/
+
+static char *read_file(const char *path) {
+	FILE *file = fopen(path, "r");
+	char *data;
+	long size;
+	
+	if(file == NULL) {
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	
+	data = (char *) malloc(size + 1);
+	if(data != NULL) {
+		size = fread(data, 1, size, file);
+		data[size] = '\0';
+	}
+	fclose(file);
+	return data;
+}
+
+/**
+ * Find the baseline time of a phase of a container. The baseline is an
+ * earlier output of this program, so it is enough to find the container's
+ * object and look for the phase inside it. Returns -1 if it is not there.
+ */
+static double baseline_ms(const char *baseline, const char *container, const char *phase) {
+	char key[1024];
+	const char *start, *end, *found;
+	
+	snprintf(key, sizeof(key), "\"container\": \"%s\"", container);
+	start = strstr(baseline, key);
+	if(start == NULL) {
+		return -1;
+	}
+	start += strlen(key);
+	end = strstr(start, "\"container\":");
+	
+	snprintf(key, sizeof(key), "\"%s\": { \"wall_ms\": ", phase);
+	found = strstr(start, key);
+	if(found == NULL || (end != NULL && found > end)) {
+		return -1;
+	}
+	return atof(found + strlen(key));
+}
+
+/// Print each phase that got slower than the baseline allows; returns how many did
+static int check_baseline(const char *baseline, const char *container, const sort_report *report, double tolerance) {
+	int phase, regressions = 0;
+	double before, after;
+	
+	for(phase = 0; phase < NUM_SORT_PHASES; ++phase) {
+		before = baseline_ms(baseline, container, sort_phase_names[phase]);
+		after = ms(report->phases[phase].wall_ns);
+		
+		if(before < 0) {
+			fprintf(stderr, "%s: no baseline for %s\n", container, sort_phase_names[phase]);
+		} else if(after > before * (1.0 + tolerance) && after - before > MIN_REGRESSION_MS) {
+			fprintf(stderr, "%s: %s regressed from %.3f ms to %.3f ms\n",
+					container, sort_phase_names[phase], before, after);
+			regressions++;
+		}
+	}
+	
+	return regressions;
+}
+
+/** Command line **/
+
+static void usage(const char *progname) {
+	fprintf(stderr, "usage: %s [options] container...\n", progname);
+	fprintf(stderr, "  -e, --engine natural|merge|radix|insert\n");
+	fprintf(stderr, "                            sort engine for playlist names (default: natural)\n");
+	fprintf(stderr, "  -j, --threads N           sort folders on N threads (default: 1)\n");
+	fprintf(stderr, "  -d, --dry-run             move entries in a simulated container instead\n");
+	fprintf(stderr, "  -n, --repeat N            run each container N times, keep the fastest (default: 3)\n");
+	fprintf(stderr, "  -b, --baseline FILE       fail if a phase is slower than in this earlier output\n");
+	fprintf(stderr, "  -t, --tolerance SHARE     slowdown allowed against the baseline (default: 0.1)\n");
+	fprintf(stderr, "  -o, --output FILE         write the JSON here instead of to stdout\n");
+	fprintf(stderr, "  -c, --check               fail unless each container comes out sorted\n");
+}
+
+static struct option long_options[] = {
+	{ "engine",    required_argument, NULL, 'e' },
+	{ "threads",   required_argument, NULL, 'j' },
+	{ "dry-run",   no_argument,       NULL, 'd' },
+	{ "repeat",    required_argument, NULL, 'n' },
+	{ "baseline",  required_argument, NULL, 'b' },
+	{ "tolerance", required_argument, NULL, 't' },
+	{ "output",    required_argument, NULL, 'o' },
+	{ "check",     no_argument,       NULL, 'c' },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char **argv) {
+	bench_options options = {
+		.sort = { .engine = SORT_ENGINE_NATURAL, .threads = 1, .quiet = 1 },
+		.repeat = 3,
+		.tolerance = 0.1,
+	};
+	sort_report *reports;
+	char *baseline = NULL;
+	FILE *file = stdout;
+	int opt, i, num_containers, regressions = 0;
+	
+	while((opt = getopt_long(argc, argv, "e:j:dn:b:t:o:c", long_options, NULL)) != EOF) {
+		switch(opt) {
+			case 'e':
+				for(i = 0; i < NUM_ENGINES && strcmp(optarg, engine_names[i]) != 0; ++i);
+				if(i == NUM_ENGINES) {
+					usage(basename(argv[0]));
+					return 1;
+				}
+				options.sort.engine = (sort_engine) i;
+				break;
+			case 'j':
+				options.sort.threads = atoi(optarg);
+				break;
+			case 'd':
+				options.sort.dry_run = 1;
+				break;
+			case 'n':
+				options.repeat = atoi(optarg);
+				break;
+			case 'b':
+				options.baseline = optarg;
+				break;
+			case 't':
+				options.tolerance = atof(optarg);
+				break;
+			case 'o':
+				options.output = optarg;
+				break;
+			case 'c':
+				options.check = 1;
+				break;
+			default:
+				usage(basename(argv[0]));
+				return 1;
+		}
+	}
+	
+	num_containers = argc - optind;
+	if(num_containers < 1 || options.sort.threads < 1 || options.repeat < 1 || options.tolerance < 0) {
+		usage(basename(argv[0]));
+		return 1;
+	}
+	
+	if(options.baseline != NULL) {
+		baseline = read_file(options.baseline);
+		if(baseline == NULL) {
+			fprintf(stderr, "Cannot read baseline %s\n", options.baseline);
+			return 1;
+		}
+	}
+	
+	reports = (sort_report *) calloc(num_containers, sizeof(sort_report));
+	if(reports == NULL) {
+		fprintf(stderr, "ERROR: out of memory\n");
+		return 1;
+	}
+	
+	// run everything before writing, so the output file can be the baseline
+	for(i = 0; i < num_containers; ++i) {
+		if(!run_container(argv[optind + i], &options, &reports[i])) {
+			return 1;
+		}
+		if(baseline != NULL) {
+			regressions += check_baseline(baseline, argv[optind + i], &reports[i], options.tolerance);
+		}
+	}
+	
+	if(options.output != NULL) {
+		file = fopen(options.output, "w");
+		if(file == NULL) {
+			fprintf(stderr, "Cannot write %s\n", options.output);
+			return 1;
+		}
+	}
+	
+	fprintf(file, "{\n");
+	fprintf(file, "  \"engine\": \"%s\",\n", engine_names[options.sort.engine]);
+	fprintf(file, "  \"threads\": %d,\n", options.sort.threads);
+	fprintf(file, "  \"dry_run\": %s,\n", options.sort.dry_run ? "true" : "false");
+	fprintf(file, "  \"repeat\": %d,\n", options.repeat);
+	fprintf(file, "  \"runs\": [\n");
+	for(i = 0; i < num_containers; ++i) {
+		write_report(file, argv[optind + i], &reports[i], i + 1 == num_containers);
+	}
+	fprintf(file, "  ]\n");
+	fprintf(file, "}\n");
+	
+	if(file != stdout) {
+		fclose(file);
+	}
+	free(reports);
+	free(baseline);
+	
+	return regressions > 0 ? 2 : 0;
+}
@@ -0,0 +1,83 @@
+#!/bin/sh
+#
+#  engines.sh
+#  SpotifySort
+#
+#  Sorts flat folders of synthetic names with each engine and prints
+#  the comparisons, how many the name prefix decided, the time spent
+#  sorting and the moves planned. Every engine has to come up with the
+#  same moves, leaving the container in the same order, entries with the
+#  same name included, or the run fails.
+#
+#    sh bench/engines.sh [size]
+#
+
+set -e
+
+cd "$(dirname "$0")/.."
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+size=${1:-200000}
+engines="natural merge radix insert"
+
+cc -std=gnu99 -O2 -o "$work/gencontainer" fake/gencontainer.c
+cc -std=gnu99 -O2 -pthread -I. -Ifake -o "$work/benchmark" bench/benchmark.c \
+	playlist.c positions.c taskpool.c timing.c simcontainer.c trace.c \
+	progress.c fake/fakespotify.c
+
+field() {
+	sed -n "s/.*\"$1\": \([0-9.]*\).*/\1/p" "$work/report.json" | head -n 1
+}
+
+# run <label> <gencontainer options>
+run() {
+	label=$1
+	shift
+	"$work/gencontainer" --size "$size" --depth 0 "$@" -o "$work/container.txt"
+	moves=
+	first=
+	for engine in $engines; do
+		FAKESPOTIFY_DUMP="$work/$engine.txt" "$work/benchmark" --check --engine "$engine" -o "$work/report.json" "$work/container.txt" 2>"$work/log.txt" || {
+			cat "$work/log.txt" >&2
+			exit 1
+		}
+		sort_ms=$(sed -n 's/.*"sort": { "wall_ms": \([0-9.]*\).*/\1/p' "$work/report.json")
+		printf "%-22s %-8s %12s %12s %10s %9s\n" "$label" "$engine" \
+			"$(field comparisons)" "$(field prefix_comparisons)" "$sort_ms" "$(field moves)"
+		if [ -n "$moves" ] && [ "$moves" != "$(field moves)" ]; then
+			echo "$engine planned $(field moves) moves where $first planned $moves" >&2
+			exit 1
+		fi
+		if [ -n "$first" ] && ! cmp -s "$work/$first.txt" "$work/$engine.txt"; then
+			echo "$engine left the container in another order than $first" >&2
+			exit 1
+		fi
+		moves=$(field moves)
+		first=${first:-$engine}
+	done
+}
+
+printf "%-22s %-8s %12s %12s %10s %9s\n" "$size names" engine comparisons "by prefix" "sort ms" moves
+
+# how much names share: nothing, the common prefixes gencontainer knows,
+# and non-ASCII names whose first bytes are all alike
+run "plain" --prefixes 0 --unicode 0
+run "prefixes 0.5" --prefixes 0.5 --unicode 0
+run "prefixes 0.95" --prefixes 0.95 --unicode 0
+run "unicode 0.5" --prefixes 0 --unicode 0.5
+run "unicode 1" --prefixes 0 --unicode 1
+run "prefixes+unicode" --prefixes 0.5 --unicode 0.5
+
+# names that repeat, whose order only a stable sort keeps
+run "duplicates 0.5" --duplicates 0.5
+run "duplicates 0.5 near" --duplicates 0.5 --disorder 0.01
+
+# how much is out of place, from a folder sorted by an earlier run with a
+# few playlists added since to one half out of place; the runs above are
+# in no order at all
+run "disorder 0" --disorder 0
+run "disorder 0.001" --disorder 0.001
+run "disorder 0.01" --disorder 0.01
+run "disorder 0.1" --disorder 0.1
+run "disorder 0.5" --disorder 0.5
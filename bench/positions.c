@@ -0,0 +1,323 @@
+/*
+ *  positions.c
+ *  SpotifySort
+ *
+ *  Times the two ways of finding where an entry currently is while a plan
+ *  of moves is applied: the position tree in positions.c, and the scan
+ *  that rewrote the position of every entry after each move, kept here to
+ *  compare against. Each size gets a plan in which a share of the entries
+ *  is moved to random places; both ways must come up with the same moves,
+ *  and the result is printed as JSON.
+ *
+ *    cc -std=gnu99 -O2 -I. -o positions bench/positions.c positions.c timing.c
+ *
+ */
+
+#include <getopt.h>
+#include <libgen.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "positions.h"
+#include "timing.h"
+
+static const int default_sizes[] = { 1000, 10000, 100000, 1000000 };
+#define NUM_DEFAULT_SIZES ((int) (sizeof(default_sizes) / sizeof(default_sizes[0])))
+
+typedef struct s_plan {
+	int size;
+	int *reorder;  // original indexes in sorted order
+	char *fixed;   // entries of reorder that stay where they are
+	int num_moved; // entries that are not fixed
+	int *from;     // of each move the position tree made, to check the scan against
+	int *to;
+	int num_moves;
+} plan;
+
+typedef struct s_result {
+	int size;
+	int num_moved;
+	int num_moves;
+	double fenwick_ms;
+	double scan_ms;   // -1 if not run
+} result;
+
+/** Random numbers **/
+
+static uint64_t g_state;
+
+static uint32_t random_below(uint32_t n) {
+	// xorshift64*, so plans only depend on the seed
+	g_state ^= g_state >> 12;
+	g_state ^= g_state << 25;
+	g_state ^= g_state >> 27;
+	return (uint32_t) (((g_state * 2685821657736338717ULL) >> 32) % n);
+}
+
+/** Plans **/
+
+typedef struct s_keyed {
+	uint64_t key;  // twice the place in sorted order, plus one if moved there
+	int index;
+} keyed;
+
+static int compare_keyed(const void *a, const void *b) {
+	const keyed *x = (const keyed *) a, *y = (const keyed *) b;
+	
+	if(x->key != y->key) {
+		return x->key < y->key ? -1 : 1;
+	}
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/*
+ * Entries that stay keep their order; the moved ones are given random
+ * places between them. The entries that stay are then an increasing
+ * subsequence of reorder, which is all a plan needs of its fixed entries.
+ */
+static int make_plan(plan *p, int size, double disorder) {
+	keyed *keys;
+	int i, moved;
+	
+	memset(p, 0, sizeof(plan));
+	p->size = size;
+	p->reorder = (int *) malloc(sizeof(int) * size);
+	p->fixed = (char *) malloc(size);
+	p->from = (int *) malloc(sizeof(int) * size);
+	p->to = (int *) malloc(sizeof(int) * size);
+	keys = (keyed *) malloc(sizeof(keyed) * size);
+	if(p->reorder == NULL || p->fixed == NULL || p->from == NULL || p->to == NULL || keys == NULL) {
+		free(keys);
+		return 0;
+	}
+	
+	for(i = 0; i < size; ++i) {
+		moved = random_below(1000000) < disorder * 1000000;
+		keys[i].key = ((uint64_t) (moved ? random_below(size) : (uint32_t) i) << 1) | moved;
+		keys[i].index = i;
+		p->num_moved += moved;
+	}
+	qsort(keys, size, sizeof(keyed), compare_keyed);
+	
+	for(i = 0; i < size; ++i) {
+		p->reorder[i] = keys[i].index;
+		p->fixed[i] = !(keys[i].key & 1);
+	}
+	
+	free(keys);
+	return 1;
+}
+
+static void free_plan(plan *p) {
+	free(p->to);
+	free(p->from);
+	free(p->fixed);
+	free(p->reorder);
+}
+
+/** The position tree **/
+
+/// Apply the plan the way apply_sort_plan() does; 0 if out of memory
+static int run_fenwick(plan *p, result *r) {
+	int *slot, *target, *occupied;
+	int i, from, to, num_slots;
+	uint64_t started = monotonic_ns();
+	
+	slot = (int *) malloc(sizeof(int) * p->size);
+	target = (int *) malloc(sizeof(int) * p->size);
+	num_slots = slot != NULL && target != NULL ? layout_slots(p->reorder, p->fixed, p->size, p->size, slot, target) : -1;
+	occupied = num_slots >= 0 ? create_position_tree(slot, p->size, num_slots) : NULL;
+	if(occupied == NULL) {
+		free(target);
+		free(slot);
+		return 0;
+	}
+	
+	p->num_moves = 0;
+	for(i = 0; i < p->size; ++i) {
+		if(p->fixed[i]) {
+			continue;
+		}
+		
+		from = fenwick_count(occupied, slot[p->reorder[i]]);
+		fenwick_add(occupied, num_slots, slot[p->reorder[i]], -1);
+		to = fenwick_count(occupied, target[i]);
+		fenwick_add(occupied, num_slots, target[i], 1);
+		slot[p->reorder[i]] = target[i];
+		
+		if(from != to) {
+			p->from[p->num_moves] = from;
+			p->to[p->num_moves] = to;
+			p->num_moves++;
+		}
+	}
+	r->fenwick_ms = (monotonic_ns() - started) / 1000000.0;
+	
+	free(occupied);
+	free(target);
+	free(slot);
+	return 1;
+}
+
+/** The scan **/
+
+static void recalculate_indexes(int *position, int size, int from, int to) {
+	int i;
+	
+	for(i = 0; i < size; ++i) {
+		if(from < to && position[i] > from && position[i] <= to) {
+			--position[i];
+		} else if(from > to && position[i] >= to && position[i] < from) {
+			++position[i];
+		}
+	}
+}
+
+/// Apply the plan by rewriting positions after each move; 0 if it disagrees with the position tree
+static int run_scan(const plan *p, result *r) {
+	int *position;
+	int i, from, to, move = 0, agrees = 1;
+	uint64_t started = monotonic_ns();
+	
+	// position[x] is the current position of the entry originally at x
+	position = (int *) malloc(sizeof(int) * p->size);
+	if(position == NULL) {
+		return 0;
+	}
+	for(i = 0; i < p->size; ++i) {
+		position[i] = i;
+	}
+	
+	// place each moved entry directly after its sorted predecessor
+	for(i = 0; i < p->size && agrees; ++i) {
+		if(p->fixed[i]) {
+			continue;
+		}
+		
+		from = position[p->reorder[i]];
+		if(i == 0) {
+			to = 0;
+		} else {
+			to = position[p->reorder[i - 1]];
+			if(from > to) {
+				++to;
+			}
+		}
+		
+		if(from != to) {
+			agrees = move < p->num_moves && p->from[move] == from && p->to[move] == to;
+			++move;
+			recalculate_indexes(position, p->size, from, to);
+			position[p->reorder[i]] = to;
+		}
+	}
+	r->scan_ms = (monotonic_ns() - started) / 1000000.0;
+	
+	for(i = 0; i < p->size && agrees; ++i) {
+		agrees = position[p->reorder[i]] == i;
+	}
+	
+	free(position);
+	return agrees && move == p->num_moves;
+}
+
+/** Command line **/
+
+static void usage(const char *progname) {
+	fprintf(stderr, "usage: %s [options] [size...]\n", progname);
+	fprintf(stderr, "  -d, --disorder SHARE      share of entries the plan moves (default: 0.01)\n");
+	fprintf(stderr, "  -m, --max-scan N          leave out the scan above N entries (default: no limit)\n");
+	fprintf(stderr, "  -s, --seed N              seed for the plans (default: 1)\n");
+	fprintf(stderr, "sizes default to 1000 10000 100000 1000000\n");
+}
+
+static struct option long_options[] = {
+	{ "disorder", required_argument, NULL, 'd' },
+	{ "max-scan", required_argument, NULL, 'm' },
+	{ "seed",     required_argument, NULL, 's' },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char **argv) {
+	double disorder = 0.01;
+	long max_scan = -1;
+	result *results;
+	plan p;
+	int opt, i, size, num_sizes;
+	
+	g_state = 1;
+	while((opt = getopt_long(argc, argv, "d:m:s:", long_options, NULL)) != EOF) {
+		switch(opt) {
+			case 'd':
+				disorder = atof(optarg);
+				break;
+			case 'm':
+				max_scan = atol(optarg);
+				break;
+			case 's':
+				g_state = strtoull(optarg, NULL, 0);
+				break;
+			default:
+				usage(basename(argv[0]));
+				return 1;
+		}
+	}
+	
+	num_sizes = optind < argc ? argc - optind : NUM_DEFAULT_SIZES;
+	if(disorder < 0 || disorder > 1 || g_state == 0) {
+		usage(basename(argv[0]));
+		return 1;
+	}
+	
+	results = (result *) calloc(num_sizes, sizeof(result));
+	if(results == NULL) {
+		fprintf(stderr, "ERROR: out of memory\n");
+		return 1;
+	}
+	
+	for(i = 0; i < num_sizes; ++i) {
+		size = optind < argc ? atoi(argv[optind + i]) : default_sizes[i];
+		if(size < 1) {
+			usage(basename(argv[0]));
+			return 1;
+		}
+		
+		if(!make_plan(&p, size, disorder) || !run_fenwick(&p, &results[i])) {
+			fprintf(stderr, "ERROR: out of memory\n");
+			return 1;
+		}
+		results[i].size = size;
+		results[i].num_moved = p.num_moved;
+		results[i].num_moves = p.num_moves;
+		results[i].scan_ms = -1;
+		
+		if(max_scan < 0 || size <= max_scan) {
+			if(!run_scan(&p, &results[i])) {
+				fprintf(stderr, "ERROR: the scan and the position tree disagree at %d entries\n", size);
+				return 1;
+			}
+		}
+		free_plan(&p);
+	}
+	
+	printf("{\n");
+	printf("  \"disorder\": %g,\n", disorder);
+	printf("  \"runs\": [\n");
+	for(i = 0; i < num_sizes; ++i) {
+		printf("    { \"entries\": %d, \"moved\": %d, \"moves\": %d, \"fenwick_ms\": %.3f, ",
+			   results[i].size, results[i].num_moved, results[i].num_moves, results[i].fenwick_ms);
+		if(results[i].scan_ms >= 0) {
+			printf("\"scan_ms\": %.3f }", results[i].scan_ms);
+		} else {
+			printf("\"scan_ms\": null }");
+		}
+		printf("%s\n", i + 1 < num_sizes ? "," : "");
+	}
+	printf("  ]\n");
+	printf("}\n");
+	
+	free(results);
+	return 0;
+}
@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+#  stress.sh
+#  SpotifySort
+#
+#  Sorts synthetic containers of 1M and 10M entries with the merge sort and
+#  checks that each comes out sorted. The flat ones hold every entry in a
+#  single list, as large libraries without folders do, so they are the
+#  ones that would run a recursive sort out of stack. The 10M containers
+#  take about a minute each and 2.5 GB of memory.
+#
+#    sh bench/stress.sh [size...]
+#
+
+set -e
+
+cd "$(dirname "$0")/.."
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+cc -std=gnu99 -O2 -o "$work/gencontainer" fake/gencontainer.c
+cc -std=gnu99 -O2 -pthread -I. -Ifake -o "$work/benchmark" bench/benchmark.c \
+	playlist.c positions.c taskpool.c timing.c simcontainer.c trace.c \
+	progress.c fake/fakespotify.c
+
+for size in ${@:-1000000 10000000}; do
+	for depth in 0 3; do
+		echo "$size entries, folders $depth deep" >&2
+		"$work/gencontainer" --size "$size" --depth "$depth" --fanout 200 -o "$work/container.txt"
+		"$work/benchmark" --check --engine merge --repeat 1 -o "$work/report.json" "$work/container.txt" 2>"$work/log.txt" || {
+			cat "$work/log.txt" >&2
+			exit 1
+		}
+		grep -E '"(comparisons|moves)"' "$work/report.json" >&2
+	done
+done
+
+echo "All sorted" >&2
@@ -0,0 +1,217 @@
+/*
+ *  changes.c
+ *  SpotifySort
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "changes.h"
+#include "timing.h"
+
+/*
+ * Renames are only reported to callbacks on the playlist itself, so every
+ * playlist in the container gets one, as do playlists added later. Folders
+ * have no callbacks of their own, so a renamed folder goes unnoticed, and a
+ * moved folder comes with no playlist to place; it only marks the whole
+ * container for sorting again, as does a change there is no memory to keep. Changes are kept in arrival order, repeats
+ * and all, and only sorted out when taken; the pointers are never followed,
+ * so one for a playlist that has since gone is harmless.
+ */
+
+struct s_change_watch {
+	sp_playlistcontainer *pc;
+	int ignoring_moves;
+	int sort_all; // a folder moved, or a change could not be kept, since changes were last taken
+	
+	sp_playlist **changed;
+	int num_changed;
+	int capacity;
+	uint64_t first_ns;
+	uint64_t last_ns;
+};
+
+static void playlist_renamed(sp_playlist *pl, void *userdata);
+static void playlist_added(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata);
+static void playlist_removed(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata);
+static void playlist_moved(sp_playlistcontainer *pc, sp_playlist *playlist, int position, int new_position, void *userdata);
+
+static sp_playlist_callbacks playlist_callbacks = {
+	.playlist_renamed = &playlist_renamed,
+};
+
+static sp_playlistcontainer_callbacks container_callbacks = {
+	.playlist_added = &playlist_added,
+	.playlist_removed = &playlist_removed,
+	.playlist_moved = &playlist_moved,
+};
+
+/** Changes **/
+
+static void note_time(change_watch *watch) {
+	watch->last_ns = monotonic_ns();
+	if(watch->num_changed == 0 && !watch->sort_all) {
+		watch->first_ns = watch->last_ns;
+	}
+}
+
+static void note_change(change_watch *watch, sp_playlist *pl) {
+	sp_playlist **grown;
+	int capacity;
+	
+	if(pl == NULL) {
+		return;
+	}
+	if(watch->num_changed == watch->capacity) {
+		capacity = watch->capacity > 0 ? watch->capacity * 2 : 64;
+		grown = (sp_playlist **) realloc(watch->changed, sizeof(sp_playlist *) * capacity);
+		if(grown == NULL) {
+			note_time(watch);
+			watch->sort_all = 1;
+			return;
+		}
+		watch->changed = grown;
+		watch->capacity = capacity;
+	}
+	note_time(watch);
+	watch->changed[watch->num_changed++] = pl;
+}
+
+static int compare_playlists(const void *a, const void *b) {
+	const sp_playlist *x = *(sp_playlist * const *) a, *y = *(sp_playlist * const *) b;
+	
+	return x < y ? -1 : x > y;
+}
+
+/** Callbacks **/
+
+static void playlist_renamed(sp_playlist *pl, void *userdata) {
+	note_change((change_watch *) userdata, pl);
+}
+
+static void playlist_added(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata) {
+	change_watch *watch = (change_watch *) userdata;
+	
+	if(playlist != NULL && sp_playlistcontainer_playlist_type(pc, position) == SP_PLAYLIST_TYPE_PLAYLIST) {
+		sp_playlist_add_callbacks(playlist, &playlist_callbacks, watch);
+		note_change(watch, playlist);
+	}
+}
+
+static void playlist_removed(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata) {
+	if(playlist != NULL) {
+		sp_playlist_remove_callbacks(playlist, &playlist_callbacks, userdata);
+	}
+}
+
+static void playlist_moved(sp_playlistcontainer *pc, sp_playlist *playlist, int position, int new_position, void *userdata) {
+	change_watch *watch = (change_watch *) userdata;
+	
+	if(watch->ignoring_moves) {
+		return;
+	}
+	if(playlist != NULL) {
+		note_change(watch, playlist);
+	} else {
+		// the start or end of a folder, or a placeholder
+		note_time(watch);
+		watch->sort_all = 1;
+	}
+}
+
+/** Watching **/
+
+/// Add or remove the rename callback on every playlist in the container
+static void watch_playlists(change_watch *watch, int watching) {
+	sp_playlist *pl;
+	int i, count = sp_playlistcontainer_num_playlists(watch->pc);
+	
+	for(i = 0; i < count; ++i) {
+		if(sp_playlistcontainer_playlist_type(watch->pc, i) != SP_PLAYLIST_TYPE_PLAYLIST) {
+			continue;
+		}
+		pl = sp_playlistcontainer_playlist(watch->pc, i);
+		if(pl == NULL) {
+			continue;
+		}
+		if(watching) {
+			sp_playlist_add_callbacks(pl, &playlist_callbacks, watch);
+		} else {
+			sp_playlist_remove_callbacks(pl, &playlist_callbacks, watch);
+		}
+	}
+}
+
+change_watch *create_change_watch(sp_playlistcontainer *pc) {
+	change_watch *watch = (change_watch *) calloc(1, sizeof(change_watch));
+	
+	if(watch == NULL) {
+		return NULL;
+	}
+	watch->pc = pc;
+	
+	sp_playlistcontainer_add_callbacks(pc, &container_callbacks, watch);
+	watch_playlists(watch, 1);
+	
+	return watch;
+}
+
+void free_change_watch(change_watch *watch) {
+	if(watch == NULL) {
+		return;
+	}
+	
+	watch_playlists(watch, 0);
+	sp_playlistcontainer_remove_callbacks(watch->pc, &container_callbacks, watch);
+	
+	free(watch->changed);
+	free(watch);
+}
+
+void change_watch_ignore_moves(change_watch *watch, int ignoring) {
+	watch->ignoring_moves = ignoring;
+}
+
+int change_watch_pending(const change_watch *watch) {
+	return watch->num_changed + watch->sort_all;
+}
+
+uint64_t change_watch_first_ns(const change_watch *watch) {
+	return watch->first_ns;
+}
+
+uint64_t change_watch_last_ns(const change_watch *watch) {
+	return watch->last_ns;
+}
+
+int take_changes(change_watch *watch, sp_playlist ***changed) {
+	sp_playlist **taken;
+	int i, count = 0;
+	
+	*changed = NULL;
+	if(watch->sort_all) {
+		watch->sort_all = 0;
+		watch->num_changed = 0;
+		return 0;
+	}
+	taken = (sp_playlist **) malloc(sizeof(sp_playlist *) * (watch->num_changed > 0 ? watch->num_changed : 1));
+	if(taken == NULL) {
+		return -1;
+	}
+	
+	if(watch->num_changed > 0) {
+		memcpy(taken, watch->changed, sizeof(sp_playlist *) * watch->num_changed);
+		qsort(taken, watch->num_changed, sizeof(sp_playlist *), compare_playlists);
+	}
+	for(i = 0; i < watch->num_changed; ++i) {
+		if(count == 0 || taken[count - 1] != taken[i]) {
+			taken[count++] = taken[i];
+		}
+	}
+	watch->num_changed = 0;
+	
+	*changed = taken;
+	return count;
+}
@@ -0,0 +1,47 @@
+/*
+ *  changes.h
+ *  SpotifySort
+ *
+ *  Collects the playlists that are added, moved or renamed in a container
+ *  after it has been sorted, from libspotify's callbacks, so that only
+ *  those need placing again, and notes when a folder has moved.
+ *
+ */
+
+#ifndef CHANGES_H_
+#define CHANGES_H_
+
+#include <stdint.h>
+
+#include <libspotify/api.h>
+
+typedef struct s_change_watch change_watch;
+
+/// Start watching the container; call from the main thread. NULL if out of memory
+extern change_watch *create_change_watch(sp_playlistcontainer *pc);
+
+/// Stop watching and free everything
+extern void free_change_watch(change_watch *watch);
+
+/// While ignoring is set moves are not counted, so our own are not taken for changes
+extern void change_watch_ignore_moves(change_watch *watch, int ignoring);
+
+/// How many changes have come in since they were last taken
+extern int change_watch_pending(const change_watch *watch);
+
+/// When the first pending change came in, on the monotonic_ns() clock
+extern uint64_t change_watch_first_ns(const change_watch *watch);
+
+/// When the last change came in, on the monotonic_ns() clock
+extern uint64_t change_watch_last_ns(const change_watch *watch);
+
+/**
+ * Hand over the playlists changed since the last call, each once, and
+ * start collecting afresh. The caller frees *changed. If a folder has
+ * moved, or a change could not be kept for lack of memory, *changed is
+ * left NULL: the whole container needs sorting again.
+ * Returns how many there are, or -1 if out of memory, leaving them pending.
+ */
+extern int take_changes(change_watch *watch, sp_playlist ***changed);
+
+#endif
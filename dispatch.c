@@ -0,0 +1,212 @@
+/*
+ *  dispatch.c
+ *  SpotifySort
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dispatch.h"
+#include "timing.h"
+#include "trace.h"
+
+/*
+ * Only one batch is out at a time. Its latency runs from the first move
+ * being sent to the last acknowledgement coming back; under half the
+ * target the next batch doubles, over the target it halves. Other clients
+ * moving playlists in the same container also count as acknowledgements,
+ * which at worst sends a batch a little early. libspotify may acknowledge
+ * a move before the call making it returns, so acknowledgements that come
+ * while a batch is being sent are kept and matched up with it afterwards.
+ */
+
+/// How long a batch should take to be acknowledged
+#define TARGET_BATCH_NS (100 * 1000000ULL)
+/// How long to go without any acknowledgement before giving up on a batch
+#define ACK_TIMEOUT_NS (30 * 1000000000ULL)
+#define FIRST_BATCH 16
+
+struct s_move_dispatch {
+	sp_playlistcontainer *pc;
+	sort_plan *plan;
+	int max_batch;
+	int wait_for_acks;
+	
+	int batch;             // moves to send next time
+	int num_sent;
+	int num_acked;
+	int num_unacked;
+	int sending;           // whether a batch is being sent right now
+	int all_sent;          // whether the plan has nothing left to send
+	uint64_t sent_ns;      // when the batch out went, 0 if none is
+	uint64_t acked_ns;     // when the last acknowledgement came
+	
+	uint64_t *latencies;   // of each batch
+	int num_batches;
+	int largest_batch;
+};
+
+static void playlist_moved(sp_playlistcontainer *pc, sp_playlist *playlist, int position, int new_position, void *userdata);
+
+static sp_playlistcontainer_callbacks container_callbacks = {
+	.playlist_moved = &playlist_moved,
+};
+
+static void playlist_moved(sp_playlistcontainer *pc, sp_playlist *playlist, int position, int new_position, void *userdata) {
+	move_dispatch *dispatch = (move_dispatch *) userdata;
+	
+	if(dispatch->sending || dispatch->num_acked < dispatch->num_sent) {
+		dispatch->num_acked++;
+		dispatch->acked_ns = monotonic_ns();
+	}
+}
+
+/** Dispatching **/
+
+move_dispatch *create_move_dispatch(sp_playlistcontainer *pc, sort_plan *plan, int max_batch, int wait_for_acks) {
+	move_dispatch *dispatch = (move_dispatch *) calloc(1, sizeof(move_dispatch));
+	
+	if(dispatch == NULL) {
+		return NULL;
+	}
+	dispatch->pc = pc;
+	dispatch->plan = plan;
+	dispatch->max_batch = max_batch > 0 ? max_batch : 1;
+	dispatch->wait_for_acks = wait_for_acks;
+	dispatch->batch = FIRST_BATCH < dispatch->max_batch ? FIRST_BATCH : dispatch->max_batch;
+	
+	if(wait_for_acks) {
+		sp_playlistcontainer_add_callbacks(pc, &container_callbacks, dispatch);
+	}
+	return dispatch;
+}
+
+void free_move_dispatch(move_dispatch *dispatch) {
+	if(dispatch == NULL) {
+		return;
+	}
+	if(dispatch->wait_for_acks) {
+		sp_playlistcontainer_remove_callbacks(dispatch->pc, &container_callbacks, dispatch);
+	}
+	free(dispatch->latencies);
+	free(dispatch);
+}
+
+/// Note how long the batch out took and size the next one to suit
+static void finish_batch(move_dispatch *dispatch) {
+	uint64_t latency = dispatch->acked_ns - dispatch->sent_ns;
+	uint64_t *grown;
+	int n = dispatch->num_batches;
+	
+	trace_span("move", "batch", dispatch->sent_ns, dispatch->acked_ns);
+	dispatch->sent_ns = 0;
+	
+	if(latency < TARGET_BATCH_NS / 2 && dispatch->batch < dispatch->max_batch) {
+		dispatch->batch = dispatch->batch * 2 < dispatch->max_batch ? dispatch->batch * 2 : dispatch->max_batch;
+	} else if(latency > TARGET_BATCH_NS && dispatch->batch > 1) {
+		dispatch->batch /= 2;
+	}
+	
+	// keep a latency per batch for the report; the array doubles at each power of two
+	if((n & (n - 1)) == 0) {
+		grown = (uint64_t *) realloc(dispatch->latencies, sizeof(uint64_t) * (n > 0 ? n * 2 : 1));
+		if(grown == NULL) {
+			return;
+		}
+		dispatch->latencies = grown;
+	}
+	dispatch->latencies[dispatch->num_batches++] = latency;
+}
+
+int dispatch_moves(move_dispatch *dispatch) {
+	uint64_t now = monotonic_ns();
+	int remaining, sent;
+	
+	if(dispatch->num_acked < dispatch->num_sent) {
+		if(now - dispatch->acked_ns < ACK_TIMEOUT_NS) {
+			return 1;
+		}
+		// libspotify has gone quiet; carry on without them, but slower
+		dispatch->num_unacked += dispatch->num_sent - dispatch->num_acked;
+		dispatch->num_acked = dispatch->num_sent;
+		dispatch->sent_ns = 0;
+		dispatch->batch = 1;
+	}
+	if(dispatch->sent_ns != 0) {
+		finish_batch(dispatch);
+	}
+	if(dispatch->all_sent) {
+		return 0;
+	}
+	
+	sent = sort_plan_moves_sent(dispatch->plan);
+	dispatch->sending = 1;
+	remaining = apply_sort_plan(dispatch->plan, dispatch->batch);
+	dispatch->sending = 0;
+	if(remaining < 0) {
+		return -1;
+	}
+	sent = sort_plan_moves_sent(dispatch->plan) - sent;
+	dispatch->all_sent = remaining == 0;
+	
+	dispatch->num_sent += sent;
+	if(dispatch->num_acked > dispatch->num_sent) {
+		dispatch->num_acked = dispatch->num_sent;
+	}
+	if(sent > 0) {
+		dispatch->sent_ns = now;
+		// unless every move was acknowledged while sending, time out from here
+		if(dispatch->num_acked < dispatch->num_sent) {
+			dispatch->acked_ns = monotonic_ns();
+		}
+		if(!dispatch->wait_for_acks) {
+			dispatch->num_acked = dispatch->num_sent;
+			dispatch->acked_ns = monotonic_ns();
+		}
+		if(sent > dispatch->largest_batch) {
+			dispatch->largest_batch = sent;
+		}
+	}
+	
+	return dispatch->all_sent && dispatch->sent_ns == 0 ? 0 : 1;
+}
+
+int dispatch_ready(const move_dispatch *dispatch) {
+	return dispatch->num_acked >= dispatch->num_sent;
+}
+
+int dispatch_timeout_ms(const move_dispatch *dispatch) {
+	uint64_t now = monotonic_ns(), deadline = dispatch->acked_ns + ACK_TIMEOUT_NS;
+	
+	if(dispatch->num_acked >= dispatch->num_sent) {
+		return 0;
+	}
+	return now < deadline ? (int) ((deadline - now + 999999) / 1000000) : 1;
+}
+
+void dispatch_moves_report(const move_dispatch *dispatch, dispatch_report *report) {
+	uint64_t *sorted;
+	
+	memset(report, 0, sizeof(dispatch_report));
+	report->num_moves = dispatch->num_sent;
+	report->num_batches = dispatch->num_batches;
+	report->largest_batch = dispatch->largest_batch;
+	report->num_unacked = dispatch->num_unacked;
+	if(dispatch->num_batches == 0) {
+		return;
+	}
+	
+	sorted = (uint64_t *) malloc(sizeof(uint64_t) * dispatch->num_batches);
+	if(sorted == NULL) {
+		return;
+	}
+	memcpy(sorted, dispatch->latencies, sizeof(uint64_t) * dispatch->num_batches);
+	sort_durations(sorted, dispatch->num_batches);
+	
+	report->p50_ms = percentile_ms(sorted, dispatch->num_batches, 50);
+	report->max_ms = percentile_ms(sorted, dispatch->num_batches, 100);
+	
+	free(sorted);
+}
@@ -0,0 +1,56 @@
+/*
+ *  dispatch.h
+ *  SpotifySort
+ *
+ *  Sends the planned moves a batch at a time between rounds of
+ *  sp_session_process_events(), waiting for libspotify to acknowledge
+ *  each batch through playlist_moved before sending the next. The batch
+ *  grows while acknowledgements come back quickly and shrinks when they
+ *  fall behind.
+ *
+ */
+
+#ifndef DISPATCH_H_
+#define DISPATCH_H_
+
+#include <libspotify/api.h>
+
+#include "playlist.h"
+
+typedef struct s_move_dispatch move_dispatch;
+
+typedef struct s_dispatch_report {
+	int num_moves;     // sent
+	int num_batches;
+	int largest_batch;
+	int num_unacked;   // given up on
+	double p50_ms;     // of the time from sending a batch to its last acknowledgement
+	double max_ms;
+} dispatch_report;
+
+/**
+ * Start sending the moves of plan, at most max_batch at a time. Without
+ * wait_for_acks each batch counts as acknowledged once sent, for moves
+ * that never reach libspotify. NULL if out of memory.
+ */
+extern move_dispatch *create_move_dispatch(sp_playlistcontainer *pc, sort_plan *plan, int max_batch, int wait_for_acks);
+
+/// Stop listening for acknowledgements and free everything but the plan
+extern void free_move_dispatch(move_dispatch *dispatch);
+
+/**
+ * Send the next batch if the last one has been acknowledged. Call once
+ * per round of events. Returns 1 while there is more to do, 0 once every
+ * move has been sent and acknowledged, or -1 if the plan failed.
+ */
+extern int dispatch_moves(move_dispatch *dispatch);
+
+/// Whether dispatch_moves() can go on without waiting for libspotify
+extern int dispatch_ready(const move_dispatch *dispatch);
+
+/// How long until dispatch_moves() gives up on the acknowledgements it waits for, in ms; 0 if none
+extern int dispatch_timeout_ms(const move_dispatch *dispatch);
+
+extern void dispatch_moves_report(const move_dispatch *dispatch, dispatch_report *report);
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ *  eventloop.c
+ *  SpotifySort
+ *
+ */
+
+#ifdef __linux__
+
+#define _GNU_SOURCE // for accept4()
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+#include "eventloop.h"
+
+/*
+ * Every descriptor sits in one epoll set, tagged in the event data with
+ * what it is. Control connections are read without blocking until a
+ * newline; the reply is written in one go, and a client that cannot take
+ * it loses it. A few clients at a time is plenty for status and quit.
+ */
+
+#define MAX_CLIENTS 4
+#define MAX_COMMAND 256
+#define MAX_EVENTS (4 + MAX_CLIENTS)
+
+enum {
+	TAG_NOTIFY,
+	TAG_TIMER,
+	TAG_SIGNAL,
+	TAG_LISTEN,
+	TAG_CLIENT // plus the client's index
+};
+
+typedef struct s_client {
+	int fd;                  // -1 if free
+	char command[MAX_COMMAND];
+	size_t length;
+} client;
+
+struct s_event_loop {
+	int epoll_fd;
+	int notify_fd;           // eventfd
+	int timer_fd;
+	int signal_fd;
+	int listen_fd;           // -1 without a control socket
+	char *control_path;
+	sigset_t signals;
+	
+	control_handler handler;
+	void *userdata;
+	client clients[MAX_CLIENTS];
+};
+
+/** Descriptors **/
+
+static int watch_fd(event_loop *loop, int fd, uint32_t tag) {
+	struct epoll_event event;
+	
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u32 = tag;
+	return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+static int listen_control(event_loop *loop, const char *path) {
+	struct sockaddr_un address;
+	
+	if(strlen(path) >= sizeof(address.sun_path)) {
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+	
+	loop->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(loop->listen_fd < 0) {
+		return 0;
+	}
+	// a socket left behind by an earlier run would make bind() fail
+	unlink(path);
+	if(bind(loop->listen_fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(loop->listen_fd, MAX_CLIENTS) != 0) {
+		return 0;
+	}
+	loop->control_path = strdup(path);
+	
+	return loop->control_path != NULL && watch_fd(loop, loop->listen_fd, TAG_LISTEN);
+}
+
+event_loop *create_event_loop(const char *control_path, control_handler handler, void *userdata) {
+	event_loop *loop = (event_loop *) calloc(1, sizeof(event_loop));
+	int i, saved;
+	
+	if(loop == NULL) {
+		return NULL;
+	}
+	loop->notify_fd = loop->timer_fd = loop->signal_fd = loop->listen_fd = -1;
+	loop->handler = handler;
+	loop->userdata = userdata;
+	for(i = 0; i < MAX_CLIENTS; ++i) {
+		loop->clients[i].fd = -1;
+	}
+	
+	sigemptyset(&loop->signals);
+	sigaddset(&loop->signals, SIGINT);
+	sigaddset(&loop->signals, SIGTERM);
+	sigaddset(&loop->signals, SIGHUP);
+	
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	loop->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(loop->epoll_fd < 0 || loop->notify_fd < 0 || loop->timer_fd < 0
+	   || pthread_sigmask(SIG_BLOCK, &loop->signals, NULL) != 0
+	   || (loop->signal_fd = signalfd(-1, &loop->signals, SFD_NONBLOCK | SFD_CLOEXEC)) < 0
+	   || !watch_fd(loop, loop->notify_fd, TAG_NOTIFY)
+	   || !watch_fd(loop, loop->timer_fd, TAG_TIMER)
+	   || !watch_fd(loop, loop->signal_fd, TAG_SIGNAL)
+	   || (control_path != NULL && !listen_control(loop, control_path))) {
+		saved = errno;
+		free_event_loop(loop);
+		errno = saved;
+		return NULL;
+	}
+	
+	return loop;
+}
+
+void free_event_loop(event_loop *loop) {
+	int i;
+	
+	if(loop == NULL) {
+		return;
+	}
+	for(i = 0; i < MAX_CLIENTS; ++i) {
+		if(loop->clients[i].fd >= 0) {
+			close(loop->clients[i].fd);
+		}
+	}
+	if(loop->control_path != NULL) {
+		unlink(loop->control_path);
+		free(loop->control_path);
+	}
+	if(loop->listen_fd >= 0) {
+		close(loop->listen_fd);
+	}
+	if(loop->signal_fd >= 0) {
+		close(loop->signal_fd);
+		pthread_sigmask(SIG_UNBLOCK, &loop->signals, NULL);
+	}
+	if(loop->timer_fd >= 0) {
+		close(loop->timer_fd);
+	}
+	if(loop->notify_fd >= 0) {
+		close(loop->notify_fd);
+	}
+	if(loop->epoll_fd >= 0) {
+		close(loop->epoll_fd);
+	}
+	free(loop);
+}
+
+/** Control socket **/
+
+static void drop_client(event_loop *loop, client *c) {
+	close(c->fd); // which also takes it out of the epoll set
+	c->fd = -1;
+	c->length = 0;
+}
+
+static void accept_clients(event_loop *loop) {
+	int fd, i;
+	
+	while((fd = accept4(loop->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		for(i = 0; i < MAX_CLIENTS && loop->clients[i].fd >= 0; ++i)
+			;
+		if(i == MAX_CLIENTS || !watch_fd(loop, fd, TAG_CLIENT + i)) {
+			close(fd);
+			continue;
+		}
+		loop->clients[i].fd = fd;
+		loop->clients[i].length = 0;
+	}
+}
+
+/// Read what the client has sent; 1 if that finished a command, which has been answered
+static int read_client(event_loop *loop, client *c) {
+	const char *reply;
+	char line[MAX_COMMAND], *end;
+	ssize_t got;
+	
+	got = read(c->fd, c->command + c->length, MAX_COMMAND - 1 - c->length);
+	if(got < 0 && (errno == EAGAIN || errno == EINTR)) {
+		return 0;
+	}
+	if(got <= 0 && c->length == 0) {
+		drop_client(loop, c);
+		return 0;
+	}
+	c->length += got > 0 ? (size_t) got : 0;
+	c->command[c->length] = 0;
+	
+	// answer once the line is complete, the client stops sending or the buffer is full
+	end = strchr(c->command, '\n');
+	if(end == NULL && got > 0 && c->length < MAX_COMMAND - 1) {
+		return 0;
+	}
+	if(end != NULL) {
+		*end = 0;
+	}
+	if(end != NULL && end > c->command && end[-1] == '\r') {
+		end[-1] = 0;
+	}
+	
+	reply = loop->handler != NULL ? loop->handler(c->command, loop->userdata) : "";
+	snprintf(line, sizeof(line), "%s\n", reply);
+	if(write(c->fd, line, strlen(line)) < 0) {
+		// the client has gone; it was being dropped anyway
+	}
+	drop_client(loop, c);
+	return 1;
+}
+
+/** Waiting **/
+
+void event_loop_notify(event_loop *loop) {
+	uint64_t one = 1;
+	
+	// a full counter is still readable, which is all that matters
+	if(write(loop->notify_fd, &one, sizeof(one)) < 0) {
+		return;
+	}
+}
+
+int event_loop_wait(event_loop *loop, int timeout_ms) {
+	struct epoll_event events[MAX_EVENTS];
+	struct itimerspec timer;
+	struct signalfd_siginfo info;
+	uint64_t count;
+	int i, n, woken = 0;
+	uint32_t tag;
+	
+	// an all-zero it_value disarms the timer
+	memset(&timer, 0, sizeof(timer));
+	timer.it_value.tv_sec = timeout_ms / 1000;
+	timer.it_value.tv_nsec = (timeout_ms % 1000) * 1000000L;
+	timerfd_settime(loop->timer_fd, 0, &timer, NULL);
+	
+	while(woken == 0) {
+		n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, -1);
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return EVENT_TIMEOUT;
+		}
+		
+		for(i = 0; i < n; ++i) {
+			tag = events[i].data.u32;
+			switch(tag) {
+				case TAG_NOTIFY:
+					if(read(loop->notify_fd, &count, sizeof(count)) == sizeof(count)) {
+						woken |= EVENT_NOTIFIED;
+					}
+					break;
+				case TAG_TIMER:
+					if(read(loop->timer_fd, &count, sizeof(count)) == sizeof(count)) {
+						woken |= EVENT_TIMEOUT;
+					}
+					break;
+				case TAG_SIGNAL:
+					while(read(loop->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+						woken |= EVENT_SIGNAL;
+					}
+					break;
+				case TAG_LISTEN:
+					accept_clients(loop);
+					break;
+				default:
+					if(loop->clients[tag - TAG_CLIENT].fd >= 0 && read_client(loop, &loop->clients[tag - TAG_CLIENT])) {
+						woken |= EVENT_CONTROL;
+					}
+					break;
+			}
+		}
+	}
+	
+	return woken;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ *  eventloop.h
+ *  SpotifySort
+ *
+ *  A main loop for Linux built on epoll. libspotify's wakeups arrive
+ *  through an eventfd and timeouts through a timerfd, so waking the main
+ *  thread takes no lock. The same wait picks up SIGINT, SIGTERM and
+ *  SIGHUP through a signalfd, and one-line commands on a control socket.
+ *
+ */
+
+#ifndef EVENTLOOP_H_
+#define EVENTLOOP_H_
+
+#ifdef __linux__
+
+typedef struct s_event_loop event_loop;
+
+/// What woke event_loop_wait(), as a mask
+enum {
+	EVENT_NOTIFIED = 1, // event_loop_notify() was called
+	EVENT_TIMEOUT = 2,
+	EVENT_SIGNAL = 4,   // SIGINT, SIGTERM or SIGHUP
+	EVENT_CONTROL = 8,  // a command came in on the control socket
+};
+
+/// Answers a command from the control socket; the reply goes back followed by a newline
+typedef const char *(*control_handler)(const char *command, void *userdata);
+
+/**
+ * Create the loop and block the signals it handles. Call before any
+ * other thread starts, so they all inherit the blocked signals. If
+ * control_path is not NULL, listen there on a Unix socket and pass each
+ * command to handler. NULL on failure, with errno set.
+ */
+extern event_loop *create_event_loop(const char *control_path, control_handler handler, void *userdata);
+
+extern void free_event_loop(event_loop *loop);
+
+/// Wake event_loop_wait(); safe from any thread
+extern void event_loop_notify(event_loop *loop);
+
+/// Sleep until notified, signalled or sent a command, or until timeout_ms pass (0 for no limit)
+extern int event_loop_wait(event_loop *loop, int timeout_ms);
+
+#endif
+
+#endif
@@ -0,0 +1,901 @@
+/*
+ *  fakespotify.c
+ *  SpotifySort
+ *
+ *  An in-process stand-in for the parts of libspotify that spotifysort
+ *  uses, so the whole tool can run offline against containers of any
+ *  size. It is configured through the environment:
+ *
+ *    FAKESPOTIFY_CONTAINER         file to load the playlist container from
+ *    FAKESPOTIFY_MOVE_LATENCY_US   time each move takes (default: 0)
+ *    FAKESPOTIFY_DUMP              file to write the final container to
+ *    FAKESPOTIFY_CONTAINER_DELAY_MS  time from login until the container loads
+ *    FAKESPOTIFY_LOAD_DELAY_MS     playlists finish loading at random times
+ *                                  up to this long after login (default: 0)
+ *    FAKESPOTIFY_RENAME_MS         rename a random playlist this often, as
+ *                                  another client might (default: never)
+ *
+ *  The container file has one entry per line:
+ *
+ *    P <name>   playlist
+ *    U <name>   playlist that never finishes loading
+ *    F <name>   start of a folder
+ *    E          end of a folder
+ *    X          placeholder
+ *
+ *  A playlist or folder may give its id straight after the type, as in
+ *  "P@0123456789abcdef <name>"; the dump always does, so a container it
+ *  writes loads again as the same one. Blank lines and lines starting with
+ *  # are ignored. Calls into the API are counted and reported on stderr
+ *  when the process exits. Moves are announced to playlist_moved callbacks
+ *  in the next round of events, or with FAKESPOTIFY_ACK_INLINE set, from
+ *  inside the move call itself, as libspotify may do.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libspotify/api.h>
+
+#include "../simcontainer.h"
+#include "../timing.h"
+
+typedef struct s_registration {
+	void *callbacks;
+	void *userdata;
+} registration;
+
+struct sp_playlist {
+	char *name;
+	uint64_t id;           // for its link, from the name it was loaded with
+	int loaded;
+	int loads;             // never for U entries
+	uint64_t load_at_ns;   // when a delayed playlist finishes loading
+	registration *registrations;
+	int num_registrations;
+};
+
+typedef struct s_move {
+	sp_playlist *playlist;
+	int position;
+	int new_position;
+} move;
+
+typedef struct s_entry {
+	sp_playlist_type type;
+	sp_playlist *playlist; // playlists only
+	char *folder_name;     // start of folders only
+	sp_uint64 folder_id;   // both ends of folders
+} entry;
+
+struct sp_playlistcontainer {
+	entry *entries;        // in the order they were loaded
+	int num_entries;
+	sim_container *order;  // of the entries now, so moves are cheap
+	int *listed;           // the same order as an array, so reads are too
+	int listed_valid;      // until the next move
+	
+	int loaded;
+	int announced;         // whether container_loaded has been called
+	uint64_t load_at_ns;
+	registration *registrations;
+	int num_registrations;
+	
+	move *moves;           // made since the last round of events
+	int num_moves;
+	int max_moves;
+};
+
+struct sp_user {
+	const char *name;
+};
+
+struct sp_link {
+	char uri[64];
+};
+
+struct sp_session {
+	sp_session_callbacks callbacks;
+	sp_user user;
+	sp_playlistcontainer container;
+	
+	int login_pending;
+	int logged_in;
+	long move_latency_us;
+	int ack_inline;        // announce moves before the move call returns
+	
+	sp_playlist **delayed; // playlists still to load, in the order they will
+	int num_delayed;
+	int next_delayed;
+	
+	uint64_t rename_every_ns; // 0 for never
+	uint64_t rename_at_ns;
+	uint64_t rename_random;
+};
+
+/** Call counting **/
+
+enum {
+	CALL_PROCESS_EVENTS,
+	CALL_NUM_PLAYLISTS,
+	CALL_PLAYLIST_TYPE,
+	CALL_PLAYLIST,
+	CALL_FOLDER_NAME,
+	CALL_FOLDER_ID,
+	CALL_MOVE_PLAYLIST,
+	CALL_PLAYLIST_IS_LOADED,
+	CALL_PLAYLIST_NAME,
+	CALL_LINK_CREATE,
+	CALL_ERRORS,
+	NUM_CALLS
+};
+
+static const char *call_names[NUM_CALLS] = {
+	"sp_session_process_events",
+	"sp_playlistcontainer_num_playlists",
+	"sp_playlistcontainer_playlist_type",
+	"sp_playlistcontainer_playlist",
+	"sp_playlistcontainer_playlist_folder_name",
+	"sp_playlistcontainer_playlist_folder_id",
+	"sp_playlistcontainer_move_playlist",
+	"sp_playlist_is_loaded",
+	"sp_playlist_name",
+	"sp_link_create_from_playlist",
+	"calls that failed",
+};
+
+static unsigned long g_calls[NUM_CALLS];
+
+/// The one session, for the exit report
+static sp_session *g_session;
+
+static void write_container(const sp_playlistcontainer *pc, FILE *file) {
+	const entry *e;
+	int i;
+	
+	if(pc->order == NULL) {
+		return;
+	}
+	
+	for(i = 0; i < pc->num_entries; ++i) {
+		e = &pc->entries[sim_container_entry(pc->order, i)];
+		switch(e->type) {
+			case SP_PLAYLIST_TYPE_PLAYLIST:
+				fprintf(file, "%c@%016llx %s\n", e->playlist->loaded ? 'P' : 'U', (unsigned long long) e->playlist->id, e->playlist->name);
+				break;
+			case SP_PLAYLIST_TYPE_START_FOLDER:
+				fprintf(file, "F@%016llx %s\n", (unsigned long long) e->folder_id, e->folder_name);
+				break;
+			case SP_PLAYLIST_TYPE_END_FOLDER:
+				fprintf(file, "E\n");
+				break;
+			case SP_PLAYLIST_TYPE_PLACEHOLDER:
+				fprintf(file, "X\n");
+				break;
+		}
+	}
+}
+
+static void report(void) {
+	const char *dump = getenv("FAKESPOTIFY_DUMP");
+	FILE *file;
+	int i;
+	
+	for(i = 0; i < NUM_CALLS; ++i) {
+		if(g_calls[i] > 0) {
+			fprintf(stderr, "fakespotify: %lu %s\n", g_calls[i], call_names[i]);
+		}
+	}
+	
+	if(dump != NULL && g_session != NULL) {
+		file = fopen(dump, "w");
+		if(file == NULL) {
+			fprintf(stderr, "fakespotify: cannot write %s: %s\n", dump, strerror(errno));
+			return;
+		}
+		write_container(&g_session->container, file);
+		fclose(file);
+	}
+}
+
+/** Loading the container **/
+
+/*
+ * Playlist links and folder ids are given in the file as written by
+ * FAKESPOTIFY_DUMP, so that a container written out and loaded again keeps
+ * them, as a real one would between runs. Entries without one get a new
+ * id, from a sequence that starts from the ids the file does give.
+ */
+
+#define MAX_DEPTH 256
+
+static uint64_t next_id(uint64_t *state) {
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL); // splitmix64
+	
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	return z != 0 ? z : 1;
+}
+
+static void assign_ids(sp_playlistcontainer *pc) {
+	sp_uint64 folders[MAX_DEPTH];
+	uint64_t state = 0;
+	int i, depth = 0;
+	entry *e;
+	
+	for(i = 0; i < pc->num_entries; ++i) {
+		e = &pc->entries[i];
+		state ^= e->playlist != NULL ? e->playlist->id : e->folder_id;
+	}
+	
+	for(i = 0; i < pc->num_entries; ++i) {
+		e = &pc->entries[i];
+		switch(e->type) {
+			case SP_PLAYLIST_TYPE_PLAYLIST:
+				if(e->playlist->id == 0) {
+					e->playlist->id = next_id(&state);
+				}
+				break;
+			case SP_PLAYLIST_TYPE_START_FOLDER:
+				if(e->folder_id == 0) {
+					e->folder_id = next_id(&state);
+				}
+				folders[depth++] = e->folder_id;
+				break;
+			case SP_PLAYLIST_TYPE_END_FOLDER:
+				e->folder_id = folders[--depth];
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+static int add_entry(sp_playlistcontainer *pc, int *capacity, entry *e) {
+	entry *entries;
+	
+	if(pc->num_entries == *capacity) {
+		*capacity = *capacity > 0 ? *capacity * 2 : 1024;
+		entries = (entry *) realloc(pc->entries, sizeof(entry) * *capacity);
+		if(entries == NULL) {
+			return 0;
+		}
+		pc->entries = entries;
+	}
+	
+	pc->entries[pc->num_entries++] = *e;
+	return 1;
+}
+
+static int load_container(sp_playlistcontainer *pc, const char *path) {
+	FILE *file;
+	char line[4096], *name;
+	entry e;
+	sp_uint64 id;
+	int capacity = 0, depth = 0, line_number = 0;
+	size_t length;
+	
+	file = fopen(path, "r");
+	if(file == NULL) {
+		fprintf(stderr, "fakespotify: cannot read %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	
+	while(fgets(line, sizeof(line), file) != NULL) {
+		++line_number;
+		length = strlen(line);
+		while(length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+			line[--length] = 0;
+		}
+		if(length == 0 || line[0] == '#') {
+			continue;
+		}
+		
+		// the id, if there is one, comes straight after the type
+		name = line + 1;
+		id = *name == '@' ? strtoull(name + 1, &name, 16) : 0;
+		if(*name == ' ') {
+			++name;
+		}
+		
+		memset(&e, 0, sizeof(e));
+		switch(line[0]) {
+			case 'P':
+			case 'U':
+				e.type = SP_PLAYLIST_TYPE_PLAYLIST;
+				e.playlist = (sp_playlist *) calloc(1, sizeof(sp_playlist));
+				e.playlist->name = strdup(name);
+				e.playlist->id = id;
+				e.playlist->loaded = e.playlist->loads = line[0] == 'P';
+				break;
+			case 'F':
+				if(depth == MAX_DEPTH) {
+					fprintf(stderr, "fakespotify: %s:%d: folders nested too deeply\n", path, line_number);
+					fclose(file);
+					return 0;
+				}
+				e.type = SP_PLAYLIST_TYPE_START_FOLDER;
+				e.folder_name = strdup(name);
+				e.folder_id = id;
+				++depth;
+				break;
+			case 'E':
+				if(depth == 0) {
+					fprintf(stderr, "fakespotify: %s:%d: end of a folder that was not started\n", path, line_number);
+					fclose(file);
+					return 0;
+				}
+				e.type = SP_PLAYLIST_TYPE_END_FOLDER;
+				--depth;
+				break;
+			case 'X':
+				e.type = SP_PLAYLIST_TYPE_PLACEHOLDER;
+				break;
+			default:
+				fprintf(stderr, "fakespotify: %s:%d: unknown entry type '%c'\n", path, line_number, line[0]);
+				fclose(file);
+				return 0;
+		}
+		
+		if(!add_entry(pc, &capacity, &e)) {
+			fprintf(stderr, "fakespotify: out of memory loading %s\n", path);
+			fclose(file);
+			return 0;
+		}
+	}
+	
+	fclose(file);
+	
+	if(depth != 0) {
+		fprintf(stderr, "fakespotify: %s: %d folders are not ended\n", path, depth);
+		return 0;
+	}
+	
+	assign_ids(pc);
+	
+	pc->order = create_sim_container(pc->num_entries);
+	pc->listed = (int *) malloc(sizeof(int) * (pc->num_entries > 0 ? pc->num_entries : 1));
+	if(pc->order == NULL || pc->listed == NULL) {
+		fprintf(stderr, "fakespotify: out of memory loading %s\n", path);
+		return 0;
+	}
+	
+	return 1;
+}
+
+static void free_container(sp_playlistcontainer *pc) {
+	int i;
+	
+	for(i = 0; i < pc->num_entries; ++i) {
+		if(pc->entries[i].playlist != NULL) {
+			free(pc->entries[i].playlist->name);
+			free(pc->entries[i].playlist->registrations);
+			free(pc->entries[i].playlist);
+		}
+		free(pc->entries[i].folder_name);
+	}
+	free(pc->entries);
+	free_sim_container(pc->order);
+	free(pc->listed);
+	free(pc->registrations);
+	free(pc->moves);
+	pc->entries = NULL;
+	pc->num_entries = 0;
+	pc->order = NULL;
+	pc->listed = NULL;
+	pc->listed_valid = 0;
+	pc->loaded = pc->announced = 0;
+	pc->registrations = NULL;
+	pc->num_registrations = 0;
+	pc->moves = NULL;
+	pc->num_moves = pc->max_moves = 0;
+}
+
+/** Callbacks **/
+
+static void add_registration(registration **list, int *count, void *callbacks, void *userdata) {
+	registration *grown = (registration *) realloc(*list, sizeof(registration) * (*count + 1));
+	
+	if(grown == NULL) {
+		++g_calls[CALL_ERRORS];
+		return;
+	}
+	grown[*count].callbacks = callbacks;
+	grown[*count].userdata = userdata;
+	*list = grown;
+	++*count;
+}
+
+static void remove_registration(registration *list, int *count, void *callbacks, void *userdata) {
+	int i;
+	
+	for(i = 0; i < *count; ++i) {
+		if(list[i].callbacks == callbacks && list[i].userdata == userdata) {
+			memmove(&list[i], &list[i + 1], sizeof(registration) * (*count - i - 1));
+			--*count;
+			return;
+		}
+	}
+}
+
+/// Whether moves need announcing; if not they are not kept, so a run without events does not pile them up
+static int announcing_moves(const sp_playlistcontainer *pc) {
+	int i;
+	
+	for(i = 0; i < pc->num_registrations; ++i) {
+		if(((sp_playlistcontainer_callbacks *) pc->registrations[i].callbacks)->playlist_moved != NULL) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/// Keep a move to announce in the next round of events
+static void queue_move(sp_playlistcontainer *pc, sp_playlist *pl, int position, int new_position) {
+	move *grown;
+	
+	if(pc->num_moves == pc->max_moves) {
+		grown = (move *) realloc(pc->moves, sizeof(move) * (pc->max_moves > 0 ? pc->max_moves * 2 : 64));
+		if(grown == NULL) {
+			++g_calls[CALL_ERRORS];
+			return;
+		}
+		pc->moves = grown;
+		pc->max_moves = pc->max_moves > 0 ? pc->max_moves * 2 : 64;
+	}
+	pc->moves[pc->num_moves].playlist = pl;
+	pc->moves[pc->num_moves].position = position;
+	pc->moves[pc->num_moves].new_position = new_position;
+	
+	// like libspotify, ask for a round of events to deliver it in
+	if(pc->num_moves++ == 0 && g_session != NULL && g_session->callbacks.notify_main_thread != NULL) {
+		g_session->callbacks.notify_main_thread(g_session);
+	}
+}
+
+/// Announce the moves made since the last round of events
+static void announce_moves(sp_playlistcontainer *pc) {
+	sp_playlistcontainer_callbacks *pcc;
+	move *moves = pc->moves;
+	int i, j, count = pc->num_moves;
+	
+	// a callback may move more, which go to a fresh queue for the next round
+	pc->moves = NULL;
+	pc->num_moves = pc->max_moves = 0;
+	
+	for(i = 0; i < count; ++i) {
+		for(j = 0; j < pc->num_registrations; ++j) {
+			pcc = (sp_playlistcontainer_callbacks *) pc->registrations[j].callbacks;
+			if(pcc->playlist_moved != NULL) {
+				pcc->playlist_moved(pc, moves[i].playlist, moves[i].position, moves[i].new_position, pc->registrations[j].userdata);
+			}
+		}
+	}
+	free(moves);
+}
+
+/** Delayed loading **/
+
+static int compare_load_times(const void *a, const void *b) {
+	uint64_t x = (*(sp_playlist * const *) a)->load_at_ns;
+	uint64_t y = (*(sp_playlist * const *) b)->load_at_ns;
+	
+	return x < y ? -1 : x > y;
+}
+
+/// Unload every playlist that loads, to load again at a random time within delay_ms of now
+static int delay_loading(sp_session *session, long delay_ms) {
+	sp_playlistcontainer *pc = &session->container;
+	uint64_t now = monotonic_ns(), random = 88172645463325252ULL;
+	sp_playlist *pl;
+	int i;
+	
+	session->delayed = (sp_playlist **) malloc(sizeof(sp_playlist *) * (pc->num_entries > 0 ? pc->num_entries : 1));
+	if(session->delayed == NULL) {
+		return 0;
+	}
+	
+	for(i = 0; i < pc->num_entries; ++i) {
+		pl = pc->entries[i].playlist;
+		if(pl == NULL || !pl->loads) {
+			continue;
+		}
+		random ^= random << 13;
+		random ^= random >> 7;
+		random ^= random << 17;
+		
+		pl->loaded = 0;
+		pl->load_at_ns = now + (random % ((uint64_t) delay_ms * 1000 + 1)) * 1000;
+		session->delayed[session->num_delayed++] = pl;
+	}
+	
+	qsort(session->delayed, session->num_delayed, sizeof(sp_playlist *), compare_load_times);
+	return 1;
+}
+
+/// Finish loading whatever is due and say when the next thing is, in ms
+static int load_due(sp_session *session) {
+	sp_playlistcontainer *pc = &session->container;
+	uint64_t now = monotonic_ns(), next = 0;
+	sp_playlistcontainer_callbacks *pcc;
+	sp_playlist_callbacks *plc;
+	sp_playlist *pl;
+	int i;
+	
+	if(!pc->loaded && now >= pc->load_at_ns) {
+		pc->loaded = 1;
+	}
+	if(pc->loaded && !pc->announced) {
+		pc->announced = 1;
+		for(i = 0; i < pc->num_registrations; ++i) {
+			pcc = (sp_playlistcontainer_callbacks *) pc->registrations[i].callbacks;
+			if(pcc->container_loaded != NULL) {
+				pcc->container_loaded(pc, pc->registrations[i].userdata);
+			}
+		}
+	}
+	
+	while(session->next_delayed < session->num_delayed && session->delayed[session->next_delayed]->load_at_ns <= now) {
+		pl = session->delayed[session->next_delayed++];
+		pl->loaded = 1;
+		for(i = 0; i < pl->num_registrations; ++i) {
+			plc = (sp_playlist_callbacks *) pl->registrations[i].callbacks;
+			if(plc->playlist_state_changed != NULL) {
+				plc->playlist_state_changed(pl, pl->registrations[i].userdata);
+			}
+		}
+	}
+	
+	if(!pc->loaded) {
+		next = pc->load_at_ns;
+	}
+	if(session->next_delayed < session->num_delayed && (next == 0 || session->delayed[session->next_delayed]->load_at_ns < next)) {
+		next = session->delayed[session->next_delayed]->load_at_ns;
+	}
+	
+	// nothing else happens by itself, so there is no other reason to come back early
+	if(next == 0 || next - now >= 1000000000ULL) {
+		return 1000;
+	}
+	return (int) ((next - now + 999999) / 1000000);
+}
+
+/// Rename a random loaded playlist whenever one is due; the time until the next, in ms, or 1000 if none
+static int rename_due(sp_session *session) {
+	sp_playlistcontainer *pc = &session->container;
+	uint64_t now = monotonic_ns();
+	sp_playlist_callbacks *plc;
+	sp_playlist *pl;
+	char *name;
+	int i, tries;
+	
+	if(session->rename_every_ns == 0 || !pc->loaded || pc->num_entries == 0) {
+		return 1000;
+	}
+	
+	for(; session->rename_at_ns <= now; session->rename_at_ns += session->rename_every_ns) {
+		for(pl = NULL, tries = 0; pl == NULL && tries < 100; ++tries) {
+			session->rename_random ^= session->rename_random << 13;
+			session->rename_random ^= session->rename_random >> 7;
+			session->rename_random ^= session->rename_random << 17;
+			pl = pc->entries[session->rename_random % pc->num_entries].playlist;
+			if(pl != NULL && !pl->loaded) {
+				pl = NULL;
+			}
+		}
+		name = (char *) malloc(20);
+		if(pl == NULL || name == NULL) {
+			free(name);
+			continue;
+		}
+		snprintf(name, 20, "Renamed %08x", (unsigned) (session->rename_random >> 32));
+		free(pl->name);
+		pl->name = name;
+		
+		for(i = 0; i < pl->num_registrations; ++i) {
+			plc = (sp_playlist_callbacks *) pl->registrations[i].callbacks;
+			if(plc->playlist_renamed != NULL) {
+				plc->playlist_renamed(pl, pl->registrations[i].userdata);
+			}
+		}
+	}
+	
+	return session->rename_at_ns - now >= 1000000000ULL ? 1000 : (int) ((session->rename_at_ns - now + 999999) / 1000000);
+}
+
+static void wait_us(long us) {
+	struct timespec ts;
+	
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	while(nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+}
+
+/** Error handling **/
+
+const char *sp_error_message(sp_error error) {
+	switch(error) {
+		case SP_ERROR_OK:
+			return "No error";
+		case SP_ERROR_BAD_USERNAME_OR_PASSWORD:
+			return "Could not load the container file";
+		case SP_ERROR_INDEX_OUT_OF_RANGE:
+			return "Index out of range";
+		default:
+			return "Unknown error";
+	}
+}
+
+/** Session handling **/
+
+sp_error sp_session_create(const sp_session_config *config, sp_session **sess) {
+	sp_session *session;
+	const char *latency = getenv("FAKESPOTIFY_MOVE_LATENCY_US");
+	const char *rename = getenv("FAKESPOTIFY_RENAME_MS");
+	const char *ack_inline = getenv("FAKESPOTIFY_ACK_INLINE");
+	
+	if(config->api_version != SPOTIFY_API_VERSION) {
+		return SP_ERROR_BAD_API_VERSION;
+	}
+	
+	session = (sp_session *) calloc(1, sizeof(sp_session));
+	if(session == NULL) {
+		return SP_ERROR_API_INITIALIZATION_FAILED;
+	}
+	
+	if(config->callbacks != NULL) {
+		session->callbacks = *config->callbacks;
+	}
+	session->move_latency_us = latency != NULL ? atol(latency) : 0;
+	session->ack_inline = ack_inline != NULL && atoi(ack_inline) != 0;
+	session->rename_every_ns = rename != NULL && atol(rename) > 0 ? atol(rename) * 1000000ULL : 0;
+	session->rename_random = 2463534242ULL;
+	
+	if(g_session == NULL) {
+		static int reporting;
+		
+		g_session = session;
+		if(!reporting) {
+			atexit(report);
+			reporting = 1;
+		}
+	}
+	
+	*sess = session;
+	return SP_ERROR_OK;
+}
+
+void sp_session_release(sp_session *sess) {
+	if(sess == g_session) {
+		report();
+		memset(g_calls, 0, sizeof(g_calls));
+		g_session = NULL;
+	}
+	free_container(&sess->container);
+	free(sess->delayed);
+	free(sess);
+}
+
+sp_error sp_session_login(sp_session *session, const char *username, const char *password) {
+	session->user.name = username;
+	session->login_pending = 1;
+	
+	if(session->callbacks.notify_main_thread != NULL) {
+		session->callbacks.notify_main_thread(session);
+	}
+	
+	return SP_ERROR_OK;
+}
+
+sp_user *sp_session_user(sp_session *session) {
+	return session->logged_in ? &session->user : NULL;
+}
+
+sp_error sp_session_logout(sp_session *session) {
+	session->logged_in = 0;
+	
+	if(session->callbacks.logged_out != NULL) {
+		session->callbacks.logged_out(session);
+	}
+	
+	return SP_ERROR_OK;
+}
+
+void sp_session_process_events(sp_session *session, int *next_timeout) {
+	const char *path = getenv("FAKESPOTIFY_CONTAINER");
+	const char *container_delay = getenv("FAKESPOTIFY_CONTAINER_DELAY_MS");
+	const char *load_delay = getenv("FAKESPOTIFY_LOAD_DELAY_MS");
+	sp_error error = SP_ERROR_OK;
+	int renamed;
+	
+	++g_calls[CALL_PROCESS_EVENTS];
+	
+	if(session->login_pending) {
+		session->login_pending = 0;
+		
+		if(path == NULL) {
+			fprintf(stderr, "fakespotify: FAKESPOTIFY_CONTAINER is not set\n");
+			error = SP_ERROR_BAD_USERNAME_OR_PASSWORD;
+		} else if(!load_container(&session->container, path)) {
+			error = SP_ERROR_BAD_USERNAME_OR_PASSWORD;
+		} else if(load_delay != NULL && atol(load_delay) > 0 && !delay_loading(session, atol(load_delay))) {
+			fprintf(stderr, "fakespotify: out of memory loading %s\n", path);
+			error = SP_ERROR_BAD_USERNAME_OR_PASSWORD;
+		} else {
+			session->logged_in = 1;
+			session->container.load_at_ns = monotonic_ns() + (container_delay != NULL ? atol(container_delay) : 0) * 1000000ULL;
+			session->container.loaded = container_delay == NULL || atol(container_delay) <= 0;
+			session->rename_at_ns = monotonic_ns() + session->rename_every_ns;
+		}
+		
+		if(session->callbacks.logged_in != NULL) {
+			session->callbacks.logged_in(session, error);
+		}
+	}
+	
+	*next_timeout = 1000;
+	if(session->logged_in) {
+		announce_moves(&session->container);
+		*next_timeout = load_due(session);
+		renamed = rename_due(session);
+		if(renamed < *next_timeout) {
+			*next_timeout = renamed;
+		}
+	}
+}
+
+sp_playlistcontainer *sp_session_playlistcontainer(sp_session *session) {
+	return session->logged_in ? &session->container : NULL;
+}
+
+/** User handling **/
+
+const char *sp_user_canonical_name(sp_user *user) {
+	return user->name;
+}
+
+const char *sp_user_display_name(sp_user *user) {
+	return user->name;
+}
+
+int sp_user_is_loaded(sp_user *user) {
+	return 1;
+}
+
+/** Playlist handling **/
+
+int sp_playlist_is_loaded(sp_playlist *playlist) {
+	++g_calls[CALL_PLAYLIST_IS_LOADED];
+	return playlist->loaded;
+}
+
+const char *sp_playlist_name(sp_playlist *playlist) {
+	++g_calls[CALL_PLAYLIST_NAME];
+	return playlist->loaded ? playlist->name : "";
+}
+
+void sp_playlist_add_callbacks(sp_playlist *playlist, sp_playlist_callbacks *callbacks, void *userdata) {
+	add_registration(&playlist->registrations, &playlist->num_registrations, callbacks, userdata);
+}
+
+void sp_playlist_remove_callbacks(sp_playlist *playlist, sp_playlist_callbacks *callbacks, void *userdata) {
+	remove_registration(playlist->registrations, &playlist->num_registrations, callbacks, userdata);
+}
+
+/** Playlist container handling **/
+
+static entry *container_entry(sp_playlistcontainer *pc, int index) {
+	if(pc->order == NULL || index < 0 || index >= pc->num_entries) {
+		++g_calls[CALL_ERRORS];
+		return NULL;
+	}
+	if(!pc->listed_valid) {
+		pc->listed_valid = sim_container_list(pc->order, pc->listed);
+		if(!pc->listed_valid) {
+			return &pc->entries[sim_container_entry(pc->order, index)];
+		}
+	}
+	return &pc->entries[pc->listed[index]];
+}
+
+int sp_playlistcontainer_num_playlists(sp_playlistcontainer *pc) {
+	++g_calls[CALL_NUM_PLAYLISTS];
+	return pc->loaded ? pc->num_entries : 0;
+}
+
+sp_playlist *sp_playlistcontainer_playlist(sp_playlistcontainer *pc, int index) {
+	entry *e = container_entry(pc, index);
+	
+	++g_calls[CALL_PLAYLIST];
+	return e != NULL ? e->playlist : NULL;
+}
+
+sp_playlist_type sp_playlistcontainer_playlist_type(sp_playlistcontainer *pc, int index) {
+	entry *e = container_entry(pc, index);
+	
+	++g_calls[CALL_PLAYLIST_TYPE];
+	return e != NULL ? e->type : SP_PLAYLIST_TYPE_PLACEHOLDER;
+}
+
+const char *sp_playlistcontainer_playlist_folder_name(sp_playlistcontainer *pc, int index) {
+	entry *e = container_entry(pc, index);
+	
+	++g_calls[CALL_FOLDER_NAME];
+	return e != NULL && e->folder_name != NULL ? e->folder_name : "";
+}
+
+sp_uint64 sp_playlistcontainer_playlist_folder_id(sp_playlistcontainer *pc, int index) {
+	entry *e = container_entry(pc, index);
+	
+	++g_calls[CALL_FOLDER_ID];
+	return e != NULL ? e->folder_id : 0;
+}
+
+sp_error sp_playlistcontainer_move_playlist(sp_playlistcontainer *pc, int index, int new_position) {
+	sp_playlist *pl;
+	int to, announce;
+	
+	++g_calls[CALL_MOVE_PLAYLIST];
+	
+	if(pc->order == NULL || index < 0 || index >= pc->num_entries || new_position < 0 || new_position > pc->num_entries) {
+		++g_calls[CALL_ERRORS];
+		return SP_ERROR_INDEX_OUT_OF_RANGE;
+	}
+	
+	if(g_session != NULL && g_session->move_latency_us > 0) {
+		wait_us(g_session->move_latency_us);
+	}
+	
+	// new_position counts from before the entry is taken out
+	to = new_position > index ? new_position - 1 : new_position;
+	announce = announcing_moves(pc);
+	pl = announce ? pc->entries[sim_container_entry(pc->order, index)].playlist : NULL;
+	sim_container_move(pc->order, index, to);
+	pc->listed_valid = 0;
+	if(announce) {
+		queue_move(pc, pl, index, new_position);
+		if(g_session != NULL && g_session->ack_inline) {
+			announce_moves(pc);
+		}
+	}
+	
+	return SP_ERROR_OK;
+}
+
+void sp_playlistcontainer_add_callbacks(sp_playlistcontainer *pc, sp_playlistcontainer_callbacks *callbacks, void *userdata) {
+	add_registration(&pc->registrations, &pc->num_registrations, callbacks, userdata);
+}
+
+void sp_playlistcontainer_remove_callbacks(sp_playlistcontainer *pc, sp_playlistcontainer_callbacks *callbacks, void *userdata) {
+	remove_registration(pc->registrations, &pc->num_registrations, callbacks, userdata);
+}
+
+/** Links **/
+
+sp_link *sp_link_create_from_playlist(sp_playlist *playlist) {
+	sp_link *link;
+	
+	++g_calls[CALL_LINK_CREATE];
+	if(playlist == NULL || !playlist->loaded) {
+		return NULL;
+	}
+	link = (sp_link *) malloc(sizeof(sp_link));
+	if(link != NULL) {
+		snprintf(link->uri, sizeof(link->uri), "spotify:user:fake:playlist:%016llx", (unsigned long long) playlist->id);
+	}
+	return link;
+}
+
+int sp_link_as_string(sp_link *link, char *buffer, int buffer_size) {
+	return snprintf(buffer, buffer_size, "%s", link->uri);
+}
+
+void sp_link_release(sp_link *link) {
+	free(link);
+}
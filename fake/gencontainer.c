@@ -0,0 +1,375 @@
+/*
+ *  gencontainer.c
+ *  SpotifySort
+ *
+ *  Writes a synthetic playlist container in the format fakespotify.c
+ *  reads, for load testing the sort at sizes and shapes real libraries
+ *  have. Each folder's children start out sorted and a share of them is
+ *  then displaced, so the amount of work left for the sort is under
+ *  control too.
+ *
+ */
+
+#include <getopt.h>
+#include <libgen.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_NODE ((uint32_t) -1)
+
+typedef struct s_gen_node {
+	uint32_t children;
+	uint32_t next;
+	uint32_t num_children;
+	int is_folder;
+	char *name; // NULL for placeholders
+} gen_node;
+
+typedef struct s_gen_options {
+	long size;          // number of entries, not counting the ends of folders
+	int depth;          // how deep folders may nest
+	int fanout;         // children per folder
+	int name_length;    // average name length in characters
+	double unicode;     // share of names with non-ASCII characters
+	double duplicates;  // share of names that repeat an earlier one
+	double prefixes;    // share of names with a common prefix
+	double placeholders;
+	double disorder;    // share of each folder's children that is displaced
+	uint64_t seed;
+	const char *output;
+} gen_options;
+
+/** Random numbers **/
+
+static uint64_t g_state;
+
+static uint64_t next_random(void) {
+	// xorshift64*, so output only depends on the seed
+	g_state ^= g_state >> 12;
+	g_state ^= g_state << 25;
+	g_state ^= g_state >> 27;
+	return g_state * 2685821657736338717ULL;
+}
+
+static uint32_t random_below(uint32_t n) {
+	return (uint32_t) ((next_random() >> 32) % n);
+}
+
+static int chance(double p) {
+	return (double) (next_random() >> 11) / (double) (1ULL << 53) < p;
+}
+
+/** Names **/
+
+static const char *ascii_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789    ";
+
+static const char *unicode_chars[] = {
+	"\xc3\xa9", "\xc3\xb8", "\xc3\x85", "\xc3\xbc", "\xc3\x9f", // é ø Å ü ß
+	"\xce\xa9", "\xd0\x96", "\xd9\x85",                         // Ω Ж م
+	"\xe6\x97\xa5", "\xe9\x9f\xb3", "\xe3\x81\x82",             // 日 音 あ
+	"\xf0\x9f\x8e\xb5",                                         // 🎵
+};
+
+static const char *common_prefixes[] = {
+	"Discover Weekly 2019-",
+	"Release Radar ",
+	"Daily Mix ",
+	"New Playlist ",
+	"My Shazam Tracks ",
+};
+
+static const char *common_names[] = {
+	"New Playlist",
+	"Favorites",
+	"Workout",
+	"Chill",
+	"Road Trip",
+};
+
+static char *random_name(const gen_options *options, char **earlier, uint32_t num_earlier) {
+	char buffer[1024];
+	const char *piece;
+	size_t length = 0, piece_length;
+	int i, target, unicode;
+	
+	if(chance(options->duplicates)) {
+		if(num_earlier > 0 && chance(0.5)) {
+			return strdup(earlier[random_below(num_earlier)]);
+		}
+		return strdup(common_names[random_below(sizeof(common_names) / sizeof(common_names[0]))]);
+	}
+	
+	if(chance(options->prefixes)) {
+		piece = common_prefixes[random_below(sizeof(common_prefixes) / sizeof(common_prefixes[0]))];
+		length = strlen(piece);
+		memcpy(buffer, piece, length);
+	}
+	
+	// somewhere between half and one and a half times the average length
+	target = options->name_length / 2 + (int) random_below(options->name_length + 1);
+	if(target < 1) {
+		target = 1;
+	}
+	unicode = chance(options->unicode);
+	
+	for(i = 0; i < target && length + 4 < sizeof(buffer); ++i) {
+		if(unicode && chance(0.3)) {
+			piece = unicode_chars[random_below(sizeof(unicode_chars) / sizeof(unicode_chars[0]))];
+			piece_length = strlen(piece);
+			memcpy(buffer + length, piece, piece_length);
+			length += piece_length;
+		} else {
+			buffer[length++] = ascii_chars[random_below((uint32_t) strlen(ascii_chars))];
+		}
+	}
+	
+	// a leading or trailing space would not survive the container format
+	while(length > 0 && buffer[length - 1] == ' ') {
+		--length;
+	}
+	if(length == 0) {
+		buffer[length++] = 'x';
+	}
+	buffer[length] = 0;
+	if(buffer[0] == ' ') {
+		buffer[0] = '_';
+	}
+	
+	return strdup(buffer);
+}
+
+/** Building the tree **/
+
+static int compare_names(const void *a, const void *b) {
+	const gen_node *x = *(const gen_node * const *) a;
+	const gen_node *y = *(const gen_node * const *) b;
+	
+	// placeholders have no name and go first; the sort does not move them anyway
+	if(x->name == NULL || y->name == NULL) {
+		return (x->name != NULL) - (y->name != NULL);
+	}
+	return strcmp(x->name, y->name);
+}
+
+/*
+ * Sort a folder's children, then move a share of them to random places
+ * in the list.
+ */
+static void arrange_children(gen_node *nodes, uint32_t parent, double disorder, gen_node **scratch) {
+	gen_node *p = &nodes[parent];
+	gen_node *moved;
+	uint32_t n, i, j, count = 0;
+	
+	for(n = p->children; n != NO_NODE; n = nodes[n].next) {
+		scratch[count++] = &nodes[n];
+	}
+	if(count < 2) {
+		return;
+	}
+	
+	qsort(scratch, count, sizeof(gen_node *), compare_names);
+	
+	for(i = 0; i < count; ++i) {
+		if(chance(disorder)) {
+			j = random_below(count);
+			moved = scratch[i];
+			scratch[i] = scratch[j];
+			scratch[j] = moved;
+		}
+	}
+	
+	p->children = (uint32_t) (scratch[0] - nodes);
+	for(i = 0; i + 1 < count; ++i) {
+		scratch[i]->next = (uint32_t) (scratch[i + 1] - nodes);
+	}
+	scratch[count - 1]->next = NO_NODE;
+}
+
+static void write_folder(FILE *file, const gen_node *nodes, uint32_t parent) {
+	uint32_t n;
+	
+	for(n = nodes[parent].children; n != NO_NODE; n = nodes[n].next) {
+		if(nodes[n].name == NULL) {
+			fprintf(file, "X\n");
+		} else if(nodes[n].is_folder) {
+			fprintf(file, "F %s\n", nodes[n].name);
+			write_folder(file, nodes, n);
+			fprintf(file, "E\n");
+		} else {
+			fprintf(file, "P %s\n", nodes[n].name);
+		}
+	}
+}
+
+static int generate(const gen_options *options, FILE *file) {
+	gen_node *nodes;
+	gen_node **scratch;
+	char **earlier;
+	uint32_t *path, *last;
+	uint32_t i, n, num_nodes, parent;
+	int depth = 0;
+	
+	num_nodes = (uint32_t) options->size + 1;
+	nodes = (gen_node *) calloc(num_nodes, sizeof(gen_node));
+	scratch = (gen_node **) malloc(sizeof(gen_node *) * num_nodes);
+	earlier = (char **) malloc(sizeof(char *) * num_nodes);
+	path = (uint32_t *) malloc(sizeof(uint32_t) * (options->depth + 1));
+	last = (uint32_t *) malloc(sizeof(uint32_t) * (options->depth + 1));
+	if(nodes == NULL || scratch == NULL || earlier == NULL || path == NULL || last == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 0;
+	}
+	
+	g_state = options->seed * 0x9E3779B97F4A7C15ULL + 1;
+	
+	// node 0 is the top level; path holds the open folders
+	nodes[0].children = NO_NODE;
+	nodes[0].is_folder = 1;
+	path[0] = 0;
+	last[0] = NO_NODE;
+	
+	for(n = 1; n < num_nodes; ++n) {
+		parent = path[depth];
+		
+		nodes[n].children = NO_NODE;
+		nodes[n].next = NO_NODE;
+		if(chance(options->placeholders)) {
+			nodes[n].name = NULL;
+		} else {
+			nodes[n].name = random_name(options, earlier, n - 1);
+			// roughly one folder per fanout entries keeps folders near that size
+			nodes[n].is_folder = depth < options->depth && chance(1.0 / options->fanout);
+		}
+		earlier[n - 1] = nodes[n].name != NULL ? nodes[n].name : "";
+		
+		if(last[depth] == NO_NODE) {
+			nodes[parent].children = n;
+		} else {
+			nodes[last[depth]].next = n;
+		}
+		last[depth] = n;
+		++nodes[parent].num_children;
+		
+		if(nodes[n].is_folder) {
+			path[++depth] = n;
+			last[depth] = NO_NODE;
+		}
+		
+		// close full folders; the top level takes whatever is left
+		while(depth > 0 && nodes[path[depth]].num_children >= (uint32_t) options->fanout) {
+			--depth;
+		}
+	}
+	
+	for(i = 0; i < num_nodes; ++i) {
+		if(nodes[i].is_folder) {
+			arrange_children(nodes, i, options->disorder, scratch);
+		}
+	}
+	
+	write_folder(file, nodes, 0);
+	
+	for(i = 1; i < num_nodes; ++i) {
+		free(nodes[i].name);
+	}
+	free(last);
+	free(path);
+	free(earlier);
+	free(scratch);
+	free(nodes);
+	return 1;
+}
+
+/** Command line **/
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [options]\n", progname);
+	fprintf(stderr, "  -n, --size N            entries, not counting folder ends (default: 10000)\n");
+	fprintf(stderr, "  -d, --depth N           maximum folder depth (default: 3)\n");
+	fprintf(stderr, "  -f, --fanout N          children per folder (default: 50)\n");
+	fprintf(stderr, "  -l, --name-length N     average name length (default: 16)\n");
+	fprintf(stderr, "  -u, --unicode P         share of names with non-ASCII characters (default: 0.1)\n");
+	fprintf(stderr, "  -D, --duplicates P      share of repeated names (default: 0.05)\n");
+	fprintf(stderr, "  -P, --prefixes P        share of names with a common prefix (default: 0.2)\n");
+	fprintf(stderr, "  -x, --placeholders P    share of placeholders (default: 0)\n");
+	fprintf(stderr, "  -s, --disorder P        share of each folder out of place (default: 1)\n");
+	fprintf(stderr, "  -r, --seed N            random seed (default: 1)\n");
+	fprintf(stderr, "  -o, --output FILE       write here instead of stdout\n");
+}
+
+static struct option long_options[] = {
+	{ "size",         required_argument, NULL, 'n' },
+	{ "depth",        required_argument, NULL, 'd' },
+	{ "fanout",       required_argument, NULL, 'f' },
+	{ "name-length",  required_argument, NULL, 'l' },
+	{ "unicode",      required_argument, NULL, 'u' },
+	{ "duplicates",   required_argument, NULL, 'D' },
+	{ "prefixes",     required_argument, NULL, 'P' },
+	{ "placeholders", required_argument, NULL, 'x' },
+	{ "disorder",     required_argument, NULL, 's' },
+	{ "seed",         required_argument, NULL, 'r' },
+	{ "output",       required_argument, NULL, 'o' },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	gen_options options = {
+		.size = 10000,
+		.depth = 3,
+		.fanout = 50,
+		.name_length = 16,
+		.unicode = 0.1,
+		.duplicates = 0.05,
+		.prefixes = 0.2,
+		.placeholders = 0,
+		.disorder = 1,
+		.seed = 1,
+		.output = NULL,
+	};
+	FILE *file = stdout;
+	int opt, ok;
+	
+	while ((opt = getopt_long(argc, argv, "n:d:f:l:u:D:P:x:s:r:o:", long_options, NULL)) != EOF) {
+		switch (opt) {
+			case 'n': options.size = atol(optarg); break;
+			case 'd': options.depth = atoi(optarg); break;
+			case 'f': options.fanout = atoi(optarg); break;
+			case 'l': options.name_length = atoi(optarg); break;
+			case 'u': options.unicode = atof(optarg); break;
+			case 'D': options.duplicates = atof(optarg); break;
+			case 'P': options.prefixes = atof(optarg); break;
+			case 'x': options.placeholders = atof(optarg); break;
+			case 's': options.disorder = atof(optarg); break;
+			case 'r': options.seed = strtoull(optarg, NULL, 10); break;
+			case 'o': options.output = optarg; break;
+			default:
+				usage(basename(argv[0]));
+				exit(1);
+		}
+	}
+	
+	if (options.size < 0 || options.size >= UINT32_MAX || options.depth < 0 || options.fanout < 1 || options.name_length < 1) {
+		usage(basename(argv[0]));
+		exit(1);
+	}
+	
+	if (options.output != NULL) {
+		file = fopen(options.output, "w");
+		if (file == NULL) {
+			perror(options.output);
+			exit(1);
+		}
+	}
+	
+	ok = generate(&options, file);
+	
+	if (file != stdout) {
+		fclose(file);
+	}
+	
+	return ok ? 0 : 1;
+}
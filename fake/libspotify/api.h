@@ -0,0 +1,137 @@
+/*
+ *  api.h
+ *  SpotifySort
+ *
+ *  The part of the libspotify 0.0.6 API that spotifysort uses, declared
+ *  for fakespotify.c so the tool can be built and run without libspotify.
+ *  Build against the real framework for anything that talks to Spotify.
+ *
+ */
+
+#ifndef FAKE_LIBSPOTIFY_API_H_
+#define FAKE_LIBSPOTIFY_API_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPOTIFY_API_VERSION 6
+
+typedef uint64_t sp_uint64;
+
+typedef struct sp_session sp_session;
+typedef struct sp_user sp_user;
+typedef struct sp_playlist sp_playlist;
+typedef struct sp_playlistcontainer sp_playlistcontainer;
+typedef struct sp_track sp_track;
+typedef struct sp_link sp_link;
+
+typedef enum sp_error {
+	SP_ERROR_OK = 0,
+	SP_ERROR_BAD_API_VERSION = 1,
+	SP_ERROR_API_INITIALIZATION_FAILED = 2,
+	SP_ERROR_TRACK_NOT_PLAYABLE = 3,
+	SP_ERROR_RESOURCE_NOT_LOADED = 4,
+	SP_ERROR_BAD_APPLICATION_KEY = 5,
+	SP_ERROR_BAD_USERNAME_OR_PASSWORD = 6,
+	SP_ERROR_USER_BANNED = 7,
+	SP_ERROR_UNABLE_TO_CONTACT_SERVER = 8,
+	SP_ERROR_CLIENT_TOO_OLD = 9,
+	SP_ERROR_OTHER_PERMANENT = 10,
+	SP_ERROR_BAD_USER_AGENT = 11,
+	SP_ERROR_MISSING_CALLBACK = 12,
+	SP_ERROR_INVALID_INDATA = 13,
+	SP_ERROR_INDEX_OUT_OF_RANGE = 14,
+	SP_ERROR_USER_NEEDS_PREMIUM = 15,
+	SP_ERROR_OTHER_TRANSIENT = 16,
+	SP_ERROR_IS_LOADING = 17,
+} sp_error;
+
+typedef enum sp_playlist_type {
+	SP_PLAYLIST_TYPE_PLAYLIST = 0,
+	SP_PLAYLIST_TYPE_START_FOLDER = 1,
+	SP_PLAYLIST_TYPE_END_FOLDER = 2,
+	SP_PLAYLIST_TYPE_PLACEHOLDER = 3,
+} sp_playlist_type;
+
+typedef struct sp_audioformat sp_audioformat;
+
+typedef struct sp_session_callbacks {
+	void (*logged_in)(sp_session *session, sp_error error);
+	void (*logged_out)(sp_session *session);
+	void (*metadata_updated)(sp_session *session);
+	void (*connection_error)(sp_session *session, sp_error error);
+	void (*message_to_user)(sp_session *session, const char *message);
+	void (*notify_main_thread)(sp_session *session);
+	int (*music_delivery)(sp_session *session, const sp_audioformat *format, const void *frames, int num_frames);
+	void (*play_token_lost)(sp_session *session);
+	void (*log_message)(sp_session *session, const char *data);
+	void (*end_of_track)(sp_session *session);
+} sp_session_callbacks;
+
+typedef struct sp_session_config {
+	int api_version;
+	const char *cache_location;
+	const char *settings_location;
+	const void *application_key;
+	size_t application_key_size;
+	const char *user_agent;
+	const sp_session_callbacks *callbacks;
+	void *userdata;
+} sp_session_config;
+
+typedef struct sp_playlist_callbacks {
+	void (*tracks_added)(sp_playlist *pl, sp_track * const *tracks, int num_tracks, int position, void *userdata);
+	void (*tracks_removed)(sp_playlist *pl, const int *tracks, int num_tracks, void *userdata);
+	void (*tracks_moved)(sp_playlist *pl, const int *tracks, int num_tracks, int new_position, void *userdata);
+	void (*playlist_renamed)(sp_playlist *pl, void *userdata);
+	void (*playlist_state_changed)(sp_playlist *pl, void *userdata);
+	void (*playlist_update_in_progress)(sp_playlist *pl, int done, void *userdata);
+	void (*playlist_metadata_updated)(sp_playlist *pl, void *userdata);
+} sp_playlist_callbacks;
+
+typedef struct sp_playlistcontainer_callbacks {
+	void (*playlist_added)(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata);
+	void (*playlist_removed)(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata);
+	void (*playlist_moved)(sp_playlistcontainer *pc, sp_playlist *playlist, int position, int new_position, void *userdata);
+	void (*container_loaded)(sp_playlistcontainer *pc, void *userdata);
+} sp_playlistcontainer_callbacks;
+
+/* Error handling */
+const char *sp_error_message(sp_error error);
+
+/* Session handling */
+sp_error sp_session_create(const sp_session_config *config, sp_session **sess);
+void sp_session_release(sp_session *sess);
+sp_error sp_session_login(sp_session *session, const char *username, const char *password);
+sp_user *sp_session_user(sp_session *session);
+sp_error sp_session_logout(sp_session *session);
+void sp_session_process_events(sp_session *session, int *next_timeout);
+sp_playlistcontainer *sp_session_playlistcontainer(sp_session *session);
+
+/* User handling */
+const char *sp_user_canonical_name(sp_user *user);
+const char *sp_user_display_name(sp_user *user);
+int sp_user_is_loaded(sp_user *user);
+
+/* Playlist handling */
+int sp_playlist_is_loaded(sp_playlist *playlist);
+const char *sp_playlist_name(sp_playlist *playlist);
+void sp_playlist_add_callbacks(sp_playlist *playlist, sp_playlist_callbacks *callbacks, void *userdata);
+void sp_playlist_remove_callbacks(sp_playlist *playlist, sp_playlist_callbacks *callbacks, void *userdata);
+
+/* Playlist container handling */
+int sp_playlistcontainer_num_playlists(sp_playlistcontainer *pc);
+sp_playlist *sp_playlistcontainer_playlist(sp_playlistcontainer *pc, int index);
+sp_playlist_type sp_playlistcontainer_playlist_type(sp_playlistcontainer *pc, int index);
+const char *sp_playlistcontainer_playlist_folder_name(sp_playlistcontainer *pc, int index);
+sp_uint64 sp_playlistcontainer_playlist_folder_id(sp_playlistcontainer *pc, int index);
+sp_error sp_playlistcontainer_move_playlist(sp_playlistcontainer *pc, int index, int new_position);
+void sp_playlistcontainer_add_callbacks(sp_playlistcontainer *pc, sp_playlistcontainer_callbacks *callbacks, void *userdata);
+void sp_playlistcontainer_remove_callbacks(sp_playlistcontainer *pc, sp_playlistcontainer_callbacks *callbacks, void *userdata);
+
+/* Links */
+sp_link *sp_link_create_from_playlist(sp_playlist *playlist);
+int sp_link_as_string(sp_link *link, char *buffer, int buffer_size);
+void sp_link_release(sp_link *link);
+
+#endif
@@ -0,0 +1,293 @@
+/*
+ *  loading.c
+ *  SpotifySort
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loading.h"
+#include "timing.h"
+
+/*
+ * Every playlist that is not loaded when it is first seen gets a record
+ * and a state callback. Records are found again from the playlist through
+ * an open-addressing table keyed on the pointer, so the record array is
+ * free to grow when playlists are added while we wait.
+ */
+
+#define NO_RECORD ((uint32_t) -1)
+
+typedef struct s_load_record {
+	sp_playlist *playlist;
+	uint64_t seen_ns;
+	uint64_t loaded_ns; // 0 while pending
+	int removed;        // from the container, and no longer called back for
+} load_record;
+
+struct s_load_wait {
+	sp_playlistcontainer *pc;
+	int container_loaded;
+	int num_playlists;
+	int failed; // a playlist could not be watched, so the wait can never end
+	
+	load_record *records;
+	uint32_t num_records;
+	uint32_t capacity;
+	int num_pending;
+	
+	uint32_t *table; // record indexes, NO_RECORD if empty
+	uint32_t table_size;
+};
+
+static void playlist_state_changed(sp_playlist *pl, void *userdata);
+static void playlist_added(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata);
+static void playlist_removed(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata);
+static void container_loaded(sp_playlistcontainer *pc, void *userdata);
+
+static sp_playlist_callbacks playlist_callbacks = {
+	.playlist_state_changed = &playlist_state_changed,
+};
+
+static sp_playlistcontainer_callbacks container_callbacks = {
+	.playlist_added = &playlist_added,
+	.playlist_removed = &playlist_removed,
+	.container_loaded = &container_loaded,
+};
+
+/** Records **/
+
+static uint32_t hash_playlist(const sp_playlist *pl) {
+	uint64_t x = (uint64_t) (uintptr_t) pl;
+	
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return (uint32_t) x;
+}
+
+static uint32_t *find_slot(const load_wait *wait, const sp_playlist *pl) {
+	uint32_t i = hash_playlist(pl) & (wait->table_size - 1);
+	
+	while(wait->table[i] != NO_RECORD && wait->records[wait->table[i]].playlist != pl) {
+		i = (i + 1) & (wait->table_size - 1);
+	}
+	return &wait->table[i];
+}
+
+static load_record *find_record(const load_wait *wait, const sp_playlist *pl) {
+	uint32_t *slot;
+	
+	if(wait->table == NULL) {
+		return NULL;
+	}
+	slot = find_slot(wait, pl);
+	return *slot != NO_RECORD ? &wait->records[*slot] : NULL;
+}
+
+static int grow_records(load_wait *wait) {
+	load_record *records;
+	uint32_t *table, i, size = wait->table_size > 0 ? wait->table_size * 2 : 1024;
+	
+	records = (load_record *) realloc(wait->records, sizeof(load_record) * (size / 2));
+	table = (uint32_t *) malloc(sizeof(uint32_t) * size);
+	if(records == NULL || table == NULL) {
+		free(table);
+		if(records != NULL) {
+			wait->records = records;
+		}
+		return 0;
+	}
+	
+	wait->records = records;
+	wait->capacity = size / 2; // keep the table at most half full
+	free(wait->table);
+	wait->table = table;
+	wait->table_size = size;
+	
+	memset(table, 0xff, sizeof(uint32_t) * size);
+	for(i = 0; i < wait->num_records; ++i) {
+		*find_slot(wait, wait->records[i].playlist) = i;
+	}
+	return 1;
+}
+
+/// Start waiting for a playlist if it is not loaded and not already waited for
+static int watch_playlist(load_wait *wait, sp_playlist *pl) {
+	load_record *record;
+	
+	if(pl == NULL || sp_playlist_is_loaded(pl)) {
+		return 1;
+	}
+	record = find_record(wait, pl);
+	if(record != NULL && !record->removed) {
+		return 1;
+	}
+	
+	// a playlist removed and added back is waited for again in its old record
+	if(record == NULL) {
+		if(wait->num_records == wait->capacity && !grow_records(wait)) {
+			return 0;
+		}
+		record = &wait->records[wait->num_records];
+		*find_slot(wait, pl) = wait->num_records++;
+	}
+	record->playlist = pl;
+	record->seen_ns = monotonic_ns();
+	record->loaded_ns = 0;
+	record->removed = 0;
+	wait->num_pending++;
+	
+	sp_playlist_add_callbacks(pl, &playlist_callbacks, wait);
+	return 1;
+}
+
+/// Look at every playlist in the container; safe to repeat. 0 if one could not be watched
+static int watch_container(load_wait *wait) {
+	sp_playlistcontainer *pc = wait->pc;
+	int i;
+	
+	wait->num_playlists = 0;
+	for(i = 0; i < sp_playlistcontainer_num_playlists(pc); ++i) {
+		if(sp_playlistcontainer_playlist_type(pc, i) == SP_PLAYLIST_TYPE_PLAYLIST) {
+			wait->num_playlists++;
+			if(!watch_playlist(wait, sp_playlistcontainer_playlist(pc, i))) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+/** Callbacks **/
+
+static void playlist_state_changed(sp_playlist *pl, void *userdata) {
+	load_wait *wait = (load_wait *) userdata;
+	load_record *record = find_record(wait, pl);
+	
+	if(record != NULL && record->loaded_ns == 0 && !record->removed && sp_playlist_is_loaded(pl)) {
+		record->loaded_ns = monotonic_ns();
+		wait->num_pending--;
+	}
+}
+
+static void playlist_added(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata) {
+	load_wait *wait = (load_wait *) userdata;
+	
+	wait->num_playlists++;
+	if(!watch_playlist(wait, playlist)) {
+		wait->failed = 1;
+	}
+}
+
+static void playlist_removed(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata) {
+	load_wait *wait = (load_wait *) userdata;
+	load_record *record = find_record(wait, playlist);
+	
+	wait->num_playlists--;
+	if(record == NULL || record->removed) {
+		return;
+	}
+	// the playlist may be freed once it is out of the container
+	sp_playlist_remove_callbacks(playlist, &playlist_callbacks, wait);
+	record->removed = 1;
+	if(record->loaded_ns == 0) {
+		wait->num_pending--;
+	}
+}
+
+static void container_loaded(sp_playlistcontainer *pc, void *userdata) {
+	load_wait *wait = (load_wait *) userdata;
+	
+	wait->container_loaded = 1;
+	if(!watch_container(wait)) {
+		wait->failed = 1;
+	}
+}
+
+/** Waiting **/
+
+load_wait *create_load_wait(sp_playlistcontainer *pc) {
+	load_wait *wait = (load_wait *) calloc(1, sizeof(load_wait));
+	
+	if(wait == NULL || !grow_records(wait)) {
+		free(wait);
+		return NULL;
+	}
+	wait->pc = pc;
+	
+	sp_playlistcontainer_add_callbacks(pc, &container_callbacks, wait);
+	
+	// a container that already has playlists has loaded before we could ask
+	if(sp_playlistcontainer_num_playlists(pc) > 0) {
+		wait->container_loaded = 1;
+		if(!watch_container(wait)) {
+			free_load_wait(wait);
+			return NULL;
+		}
+	}
+	
+	return wait;
+}
+
+void free_load_wait(load_wait *wait) {
+	uint32_t i;
+	
+	if(wait == NULL) {
+		return;
+	}
+	
+	sp_playlistcontainer_remove_callbacks(wait->pc, &container_callbacks, wait);
+	for(i = 0; i < wait->num_records; ++i) {
+		if(!wait->records[i].removed) {
+			sp_playlist_remove_callbacks(wait->records[i].playlist, &playlist_callbacks, wait);
+		}
+	}
+	
+	free(wait->table);
+	free(wait->records);
+	free(wait);
+}
+
+int load_wait_container_loaded(const load_wait *wait) {
+	return wait->container_loaded;
+}
+
+int load_wait_done(const load_wait *wait) {
+	return wait->container_loaded && wait->num_pending == 0 && !wait->failed;
+}
+
+int load_wait_failed(const load_wait *wait) {
+	return wait->failed;
+}
+
+void load_wait_report(const load_wait *wait, load_report *report) {
+	uint64_t *durations;
+	uint32_t i;
+	int count = 0;
+	
+	memset(report, 0, sizeof(load_report));
+	report->num_playlists = wait->num_playlists;
+	report->num_waited = (int) wait->num_records;
+	report->num_pending = wait->num_pending;
+	
+	durations = (uint64_t *) malloc(sizeof(uint64_t) * (wait->num_records > 0 ? wait->num_records : 1));
+	if(durations == NULL) {
+		return;
+	}
+	for(i = 0; i < wait->num_records; ++i) {
+		if(wait->records[i].loaded_ns != 0) {
+			durations[count++] = wait->records[i].loaded_ns - wait->records[i].seen_ns;
+		}
+	}
+	sort_durations(durations, count);
+	
+	report->p50_ms = percentile_ms(durations, count, 50);
+	report->p90_ms = percentile_ms(durations, count, 90);
+	report->p99_ms = percentile_ms(durations, count, 99);
+	report->max_ms = percentile_ms(durations, count, 100);
+	
+	free(durations);
+}
@@ -0,0 +1,45 @@
+/*
+ *  loading.h
+ *  SpotifySort
+ *
+ *  Waits for the playlist container and every playlist in it to load,
+ *  counting the loads still outstanding from libspotify's callbacks
+ *  rather than polling, and keeps how long each one took.
+ *
+ */
+
+#ifndef LOADING_H_
+#define LOADING_H_
+
+#include <libspotify/api.h>
+
+typedef struct s_load_wait load_wait;
+
+typedef struct s_load_report {
+	int num_playlists; // seen in the container
+	int num_waited;    // not loaded when first seen
+	int num_pending;   // still not loaded
+	double p50_ms;     // of the time each waited-for playlist took to load
+	double p90_ms;
+	double p99_ms;
+	double max_ms;
+} load_report;
+
+/// Start watching the container; call from the main thread. NULL if out of memory
+extern load_wait *create_load_wait(sp_playlistcontainer *pc);
+
+/// Stop watching and free everything
+extern void free_load_wait(load_wait *wait);
+
+/// Whether the container itself has loaded, if not yet all its playlists
+extern int load_wait_container_loaded(const load_wait *wait);
+
+/// Whether the container and all its playlists are loaded
+extern int load_wait_done(const load_wait *wait);
+
+/// Whether a playlist could not be watched for lack of memory, so the wait has to be given up
+extern int load_wait_failed(const load_wait *wait);
+
+extern void load_wait_report(const load_wait *wait, load_report *report);
+
+#endif
@@ -28,6 +28,7 @@
  */
 
 #include <errno.h>
+#include <getopt.h>
 #include <libgen.h>
 #include <pthread.h>
 #include <stdint.h>
@@ -35,13 +36,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/time.h>
+#include <time.h>
 
 #include <libspotify/api.h>
 
+#include "changes.h"
+#include "dispatch.h"
+#include "eventloop.h"
+#include "loading.h"
 #include "playlist.h"
+#include "snapshot.h"
+#include "trace.h"
 
 /* --- Data --- */
+/// Where libspotify keeps its cache, and by default the snapshot
+#define CACHE_LOCATION "/tmp/spotifysort"
+
 /// The application key is specific to each project, and allows Spotify
 /// to produce statistics on how our service is used.
 extern const uint8_t g_appkey[];
@@ -55,38 +65,460 @@ static pthread_cond_t g_notify_cond;
 /// Synchronization variable telling the main thread to process events
 static int g_notify_do;
 
-/// Synchronization variable telling the main thread to quit
-static int g_quit;
+/// How the main thread slept between rounds of events
+typedef struct loop_stats {
+	int wakeups;          // returns from waiting on the condition variable
+	int notified;         // ... to find libspotify had asked for a round
+	int timeouts;         // ... because the time was up
+	int spurious;         // ... for no reason at all
+	int requests;         // ... for a signal or a control command
+	uint64_t idle_ns;     // wall-clock time spent waiting
+	uint64_t idle_cpu_ns; // CPU time the process used meanwhile, on any thread
+} loop_stats;
+
+static loop_stats g_loop_stats;
+
+#ifdef __linux__
+/// Whether to wait on epoll instead of the condition variable
+static int g_use_epoll;
+/// Where to listen for control commands, if anywhere
+static const char *g_control_path;
+/// The epoll loop, when it is used
+static event_loop *g_event_loop;
+#endif
+
+/// Where the run has got to. The callbacks only move it on from the
+/// states they wait for; everything else is done by advance() from the
+/// main loop, so no callback ever waits on the sort. libspotify only calls
+/// back from sp_session_process_events(), which only the main loop calls,
+/// so the load wait, change watch and dispatch that the callbacks feed all
+/// stay on the main thread and take no locks.
+typedef enum run_state {
+	RUN_LOGGING_IN,       // waiting for logged_in
+	RUN_LOGGED_IN,        // waiting for the playlist container to load
+	RUN_CONTAINER_LOADED, // waiting for the playlists in it to load
+	RUN_PLAYLISTS_LOADED, // ready to plan the sort
+	RUN_PLANNED,          // sending the planned moves, a batch per round
+	RUN_APPLIED,          // all acknowledged, ready to log out
+	RUN_WATCHING,         // as a daemon, waiting for the container to change
+	RUN_LOGGING_OUT,      // waiting for logged_out
+	RUN_LOGGED_OUT,       // the main loop stops here
+} run_state;
+
+static run_state g_state = RUN_LOGGING_IN;
+/// How each state reads in a status reply
+static const char *g_state_names[] = {
+	"logging in",
+	"loading the container",
+	"loading playlists",
+	"planning",
+	"moving playlists",
+	"finishing",
+	"watching for changes",
+	"logging out",
+	"logged out",
+};
+/// Set by a signal or the quit command to stop early, logging out cleanly
+static int g_stop_requested;
+/// What the logged_in callback was told
+static sp_error g_login_error = SP_ERROR_OK;
+/// The exit status of the run
+static int g_exit_status;
+
+/// How to sort, as given on the command line
+static sort_options g_sort_options = {
+	.engine = SORT_ENGINE_NATURAL,
+	.threads = 1,
+	.progress_rate = 4,
+};
+
+/// Seconds to wait for the container and its playlists to load
+static int g_load_timeout = 300;
+/// The container and playlists being waited for, until they have loaded
+static load_wait *g_load_wait;
+/// When to stop waiting for them, on the monotonic_ns() clock
+static uint64_t g_load_deadline_ns;
+/// How the wait went
+static load_report g_load_report;
+
+/// Where to write the phase timings as JSON, if anywhere
+static const char *g_timings_path;
+/// Times the phases of the run, one after another
+static stopwatch g_watch;
+/// From sp_session_login() until the logged_in callback
+static phase_report g_login_phase;
+/// From logging in until the container and its playlists are there to sort
+static phase_report g_load_phase;
+/// The phases of the sort itself
+static sort_report g_sort_report;
+/// The moves still to send, once the sort is planned
+static sort_plan *g_plan;
+/// Most moves to send between rounds of events
+static int g_max_batch = 256;
+/// Sends the moves and waits for them to be acknowledged
+static move_dispatch *g_dispatch;
+/// How that went
+static dispatch_report g_dispatch_report;
+
+/// Whether to stay logged in after sorting and keep the container sorted
+static int g_daemon;
+/// How long the container must go without changing before they are placed, in ms
+static int g_debounce_ms = 2000;
+/// But changes never wait longer than this many debounce windows
+#define MAX_DEBOUNCE_WINDOWS 5
+/// Collects changes to the container while watching
+static change_watch *g_changes;
+/// The changed playlists being placed, or NULL for a full sort
+static sp_playlist **g_changed;
+static int g_num_changed;
+
+/// The directory to keep a snapshot of the sorted container in
+static const char *g_snapshot_dir = CACHE_LOCATION;
+/// The snapshot itself, one per user, once logged in
+static char g_snapshot_path[1024];
+/// Whether to sort the whole container, whatever the snapshot says
+static int g_full_sort;
+/// The entries changed since the snapshot, by container index, or NULL
+static uint8_t *g_changed_entries;
 
-/* ---------------------------  SESSION CALLBACKS  ------------------------- */
 /**
- * This callback is called when an attempt to login has succeeded or failed.
+ * Charge the time since the last phase ended to this one
  *
- * @sa sp_session_callbacks#logged_in
+ * @param  name   The phase, for the trace
+ * @param  phase  Where to add the time
  */
-static void logged_in(sp_session *sess, sp_error error)
+static void end_phase(const char *name, phase_report *phase)
 {
+	uint64_t started = g_watch.wall_ns;
 	
-	sp_user *me;
-	const char *my_name;
+	stop_phase(&g_watch, phase);
+	trace_span("phase", name, started, g_watch.wall_ns);
+}
+
+/**
+ * Stop waiting for the container, saying how long the playlists took
+ */
+static void finish_loading(void)
+{
+	end_phase("load", &g_load_phase);
+	load_wait_report(g_load_wait, &g_load_report);
+	free_load_wait(g_load_wait);
+	g_load_wait = NULL;
 	
-	if (SP_ERROR_OK != error) {
-		fprintf(stderr, "Failed to log in to Spotify: %s\n",
-				sp_error_message(error));
-		sp_session_release(sess);
-		exit(4);
+	if (g_load_report.num_waited > g_load_report.num_pending) {
+		fprintf(stderr, "Waited for %d of %d playlists to load: p50 %.0f ms, p90 %.0f ms, p99 %.0f ms, max %.0f ms\n",
+				g_load_report.num_waited - g_load_report.num_pending, g_load_report.num_playlists,
+				g_load_report.p50_ms, g_load_report.p90_ms, g_load_report.p99_ms, g_load_report.max_ms);
 	}
+}
+
+/**
+ * How much longer to wait for pending changes to stop coming
+ *
+ * @return The time in ms; 0 once they should be placed
+ */
+static int debounce_ms(void)
+{
+	uint64_t now = monotonic_ns(), window = (uint64_t) g_debounce_ms * 1000000ULL;
+	uint64_t quiet = change_watch_last_ns(g_changes) + window;
+	uint64_t latest = change_watch_first_ns(g_changes) + MAX_DEBOUNCE_WINDOWS * window;
+	uint64_t due = quiet < latest ? quiet : latest;
 	
-	me = sp_session_user(sess);
-	my_name = (sp_user_is_loaded(me) ? sp_user_display_name(me) : sp_user_canonical_name(me));
-	fprintf(stderr, "Logged in to Spotify as user %s\n", my_name);
-	
-	sort_playlists(sess);
+	return now < due ? (int) ((due - now + 999999) / 1000000) : 0;
+}
+
+/**
+ * Let go of the sort, finished or not
+ */
+static void finish_sort(void)
+{
+	if (g_dispatch != NULL) {
+		dispatch_moves_report(g_dispatch, &g_dispatch_report);
+		free_move_dispatch(g_dispatch);
+		g_dispatch = NULL;
+	}
+	if (g_plan != NULL) {
+		free_sort_plan(g_plan);
+		g_plan = NULL;
+	}
+	free(g_changed);
+	g_changed = NULL;
+	g_num_changed = 0;
+	free(g_changed_entries);
+	g_changed_entries = NULL;
+}
+
+/**
+ * Log out, once the container is sorted or cannot be
+ *
+ * @param  sess    The session
+ * @param  status  The exit status of the run
+ */
+static void log_out(sp_session *sess, int status)
+{
+	finish_sort();
+	free_change_watch(g_changes);
+	g_changes = NULL;
 	
+	g_exit_status = status;
+	// logged_out may be called from inside sp_session_logout()
+	g_state = RUN_LOGGING_OUT;
 	sp_session_logout(sess);
+}
+
+/**
+ * Take whatever steps the run is ready for. Called from the main loop
+ * after each round of events, so each step starts as soon as whatever it
+ * waits for has arrived.
+ *
+ * @param  sess  The session
+ */
+static void advance(sp_session *sess)
+{
+	run_state previous;
+	sp_user *me;
+	
+	if (g_stop_requested && g_state < RUN_LOGGING_OUT) {
+		g_stop_requested = 0;
+		fprintf(stderr, "Stopping while %s\n", g_state_names[g_state]);
+		if (g_load_wait != NULL)
+			finish_loading();
+		if (g_state == RUN_LOGGING_IN) {
+			g_exit_status = 1;
+			g_state = RUN_LOGGED_OUT;
+		} else {
+			// stopping is how a daemon ends, but otherwise cuts the sort short
+			log_out(sess, g_state == RUN_WATCHING ? 0 : 1);
+		}
+	}
+	
+	do {
+		previous = g_state;
+		
+		switch (g_state) {
+			case RUN_LOGGED_IN:
+				// the deadline is set on the first pass after logging in
+				if (g_load_deadline_ns == 0) {
+					if (SP_ERROR_OK != g_login_error) {
+						fprintf(stderr, "Failed to log in to Spotify: %s\n",
+								sp_error_message(g_login_error));
+						g_exit_status = 4;
+						g_state = RUN_LOGGED_OUT;
+						break;
+					}
+					
+					me = sp_session_user(sess);
+					fprintf(stderr, "Logged in to Spotify as user %s\n",
+							sp_user_is_loaded(me) ? sp_user_display_name(me) : sp_user_canonical_name(me));
+					end_phase("login", &g_login_phase);
+					snprintf(g_snapshot_path, sizeof(g_snapshot_path), "%s/%s.snapshot",
+							 g_snapshot_dir, sp_user_canonical_name(me));
+					
+					if (g_load_wait == NULL) {
+						fprintf(stderr, "ERROR: out of memory\n");
+						log_out(sess, 1);
+						break;
+					}
+					g_load_deadline_ns = monotonic_ns() + (uint64_t) g_load_timeout * 1000000000ULL;
+				}
+				
+				if (load_wait_failed(g_load_wait)) {
+					finish_loading();
+					fprintf(stderr, "ERROR: out of memory\n");
+					log_out(sess, 1);
+				} else if (load_wait_container_loaded(g_load_wait)) {
+					g_state = RUN_CONTAINER_LOADED;
+				} else if (monotonic_ns() >= g_load_deadline_ns) {
+					finish_loading();
+					fprintf(stderr, "ERROR: the playlist container did not load within %d seconds\n", g_load_timeout);
+					log_out(sess, 1);
+				}
+				break;
+				
+			case RUN_CONTAINER_LOADED:
+				if (load_wait_failed(g_load_wait)) {
+					finish_loading();
+					fprintf(stderr, "ERROR: out of memory\n");
+					log_out(sess, 1);
+				} else if (load_wait_done(g_load_wait)) {
+					g_state = RUN_PLAYLISTS_LOADED;
+				} else if (monotonic_ns() >= g_load_deadline_ns) {
+					finish_loading();
+					fprintf(stderr, "ERROR: %d playlists did not load within %d seconds\n", g_load_report.num_pending, g_load_timeout);
+					log_out(sess, 1);
+				}
+				break;
+				
+			case RUN_PLAYLISTS_LOADED:
+				finish_loading();
+				// the first sort of a run need only place what changed since the last
+				if (g_changed == NULL && g_changes == NULL && !g_full_sort && !g_sort_options.dry_run) {
+					g_num_changed = diff_snapshot(sp_session_playlistcontainer(sess), g_snapshot_path, &g_changed_entries);
+					if (g_num_changed == 0) {
+						fprintf(stderr, "Nothing has changed since the last run\n");
+						finish_sort();
+						g_state = RUN_APPLIED;
+						break;
+					}
+				}
+				// a change from elsewhere while the moves go out can leave the container unsorted
+				if (g_changes == NULL && !g_sort_options.dry_run) {
+					g_changes = create_change_watch(sp_session_playlistcontainer(sess));
+					if (g_changes == NULL) {
+						fprintf(stderr, "ERROR: out of memory\n");
+						log_out(sess, 1);
+						break;
+					}
+					change_watch_ignore_moves(g_changes, 1);
+				}
+				if (g_changed != NULL) {
+					g_plan = plan_placement(sess, &g_sort_options, g_changed, g_num_changed, &g_sort_report);
+				} else if (g_changed_entries != NULL) {
+					g_plan = plan_changed_entries(sess, &g_sort_options, g_changed_entries, g_num_changed, &g_sort_report);
+				} else {
+					g_plan = plan_sort(sess, &g_sort_options, &g_sort_report);
+				}
+				if (g_plan == NULL) {
+					log_out(sess, 1);
+					break;
+				}
+				g_dispatch = create_move_dispatch(sp_session_playlistcontainer(sess), g_plan, g_max_batch, !g_sort_options.dry_run);
+				if (g_dispatch == NULL) {
+					fprintf(stderr, "ERROR: out of memory\n");
+					log_out(sess, 1);
+					break;
+				}
+				g_state = RUN_PLANNED;
+				break;
+				
+			case RUN_PLANNED:
+				switch (dispatch_moves(g_dispatch)) {
+					case -1:
+						log_out(sess, 1);
+						break;
+					case 0:
+						g_state = RUN_APPLIED;
+						break;
+				}
+				break;
+				
+			case RUN_APPLIED:
+				if (g_dispatch != NULL)
+					dispatch_moves_report(g_dispatch, &g_dispatch_report);
+				if (g_dispatch_report.num_batches > 0) {
+					fprintf(stderr, "Sent %d moves in %d batches of up to %d, acknowledged in p50 %.0f ms, max %.0f ms\n",
+							g_dispatch_report.num_moves, g_dispatch_report.num_batches, g_dispatch_report.largest_batch,
+							g_dispatch_report.p50_ms, g_dispatch_report.max_ms);
+				}
+				if (g_dispatch_report.num_unacked > 0) {
+					fprintf(stderr, "WARNING: %d moves were never acknowledged\n", g_dispatch_report.num_unacked);
+				}
+				// the next run trusts the snapshot to be sorted, so keep none if anything got in the way
+				if (g_plan != NULL && !g_sort_options.dry_run) {
+					if (g_dispatch_report.num_unacked > 0 || change_watch_pending(g_changes) > 0)
+						fprintf(stderr, "Not keeping a snapshot, as the container changed while it was sorted\n");
+					else
+						save_snapshot(sp_session_playlistcontainer(sess), g_snapshot_path);
+				}
+				if (!g_daemon) {
+					log_out(sess, 0);
+					break;
+				}
+				
+				finish_sort();
+				if (g_changes == NULL) {
+					g_changes = create_change_watch(sp_session_playlistcontainer(sess));
+					if (g_changes == NULL) {
+						fprintf(stderr, "ERROR: out of memory\n");
+						log_out(sess, 1);
+						break;
+					}
+				}
+				change_watch_ignore_moves(g_changes, 0);
+				fprintf(stderr, "Watching for changes\n");
+				g_state = RUN_WATCHING;
+				break;
+				
+			case RUN_WATCHING:
+				// place the changes once they stop coming, or have waited long enough
+				if (change_watch_pending(g_changes) == 0 || debounce_ms() > 0)
+					break;
+				
+				g_num_changed = take_changes(g_changes, &g_changed);
+				if (g_num_changed < 0) {
+					g_num_changed = 0;
+					break;
+				}
+				if (g_changed == NULL)
+					fprintf(stderr, "A folder was moved or a change was lost, so the whole container is sorted again\n");
+				// our own moves are not changes; and new playlists may still be loading
+				change_watch_ignore_moves(g_changes, 1);
+				g_load_wait = create_load_wait(sp_session_playlistcontainer(sess));
+				if (g_load_wait == NULL) {
+					fprintf(stderr, "ERROR: out of memory\n");
+					log_out(sess, 1);
+					break;
+				}
+				g_load_deadline_ns = monotonic_ns() + (uint64_t) g_load_timeout * 1000000000ULL;
+				g_state = RUN_CONTAINER_LOADED;
+				break;
+				
+			default:
+				break;
+		}
+	} while (g_state != previous);
+}
+
+/**
+ * How long the main loop may sleep without missing the load deadline,
+ * giving up on acknowledgements too late or sitting on changes too long
+ *
+ * @param  next_timeout  What libspotify asked for, in ms; 0 for no limit
+ * @return The time to sleep in ms; 0 for no limit
+ */
+static int loop_timeout_ms(int next_timeout)
+{
+	uint64_t now = monotonic_ns();
+	int remaining;
 	
-	g_quit = 1;
+	if (g_load_wait != NULL)
+		remaining = now < g_load_deadline_ns ? (int) ((g_load_deadline_ns - now + 999999) / 1000000) : 1;
+	else if (g_dispatch != NULL && dispatch_timeout_ms(g_dispatch) > 0)
+		remaining = dispatch_timeout_ms(g_dispatch);
+	else if (g_state == RUN_WATCHING && change_watch_pending(g_changes) > 0)
+		remaining = debounce_ms() > 0 ? debounce_ms() : 1;
+	else
+		return next_timeout;
 	
+	return next_timeout == 0 || next_timeout > remaining ? remaining : next_timeout;
+}
+
+/* ---------------------------  SESSION CALLBACKS  ------------------------- */
+/**
+ * This callback is called when an attempt to login has succeeded or failed.
+ *
+ * @sa sp_session_callbacks#logged_in
+ */
+static void logged_in(sp_session *sess, sp_error error)
+{
+	// the rest is done from the main loop; see advance()
+	g_login_error = error;
+	g_state = RUN_LOGGED_IN;
+	
+	// container_loaded may come in this same round of events and is not
+	// called again, so start watching before it can; NULL is out of memory
+	if (SP_ERROR_OK == error)
+		g_load_wait = create_load_wait(sp_session_playlistcontainer(sess));
+}
+
+/**
+ * This callback is called when the session has logged out.
+ *
+ * @sa sp_session_callbacks#logged_out
+ */
+static void logged_out(sp_session *sess)
+{
+	g_state = RUN_LOGGED_OUT;
 }
 
 /**
@@ -99,6 +531,13 @@ static void logged_in(sp_session *sess, sp_error error)
  */
 static void notify_main_thread(sp_session *sess)
 {
+	trace_marker("main loop", "notify_main_thread");
+#ifdef __linux__
+	if (g_event_loop != NULL) {
+		event_loop_notify(g_event_loop);
+		return;
+	}
+#endif
 	pthread_mutex_lock(&g_notify_mutex);
 	g_notify_do = 1;
 	pthread_cond_signal(&g_notify_cond);
@@ -120,6 +559,7 @@ static void log_message(sp_session *session, const char *data)
  */
 static sp_session_callbacks session_callbacks = {
 	.logged_in = &logged_in,
+	.logged_out = &logged_out,
 	.notify_main_thread = &notify_main_thread,
 	.music_delivery = NULL,
 	.metadata_updated = NULL,
@@ -134,7 +574,7 @@ static sp_session_callbacks session_callbacks = {
  */
 static sp_session_config spconfig = {
 	.api_version = SPOTIFY_API_VERSION,
-	.cache_location = "/tmp/spotifysort",
+	.cache_location = CACHE_LOCATION,
 	.settings_location = "/tmp/spotifysort",
 	.application_key = g_appkey,
 	.application_key_size = 0, // Set in main()
@@ -145,6 +585,215 @@ static sp_session_config spconfig = {
 /* -------------------------  END SESSION CALLBACKS  ----------------------- */
 
 
+/* -------------------------------  MAIN LOOP  ----------------------------- */
+/**
+ * Set up the condition variable the main thread sleeps on. It times out
+ * on the monotonic clock where the platform allows, so setting the wall
+ * clock neither wakes it early nor keeps it asleep.
+ */
+static void init_notify(void)
+{
+	pthread_condattr_t attr;
+	
+	pthread_mutex_init(&g_notify_mutex, NULL);
+	pthread_condattr_init(&attr);
+#ifndef __APPLE__
+	// Mac OS X has no pthread_condattr_setclock(); see wait_for_notify()
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+	pthread_cond_init(&g_notify_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/**
+ * Sleep until libspotify asks for a round of events or the time is up.
+ * Called with g_notify_mutex held.
+ *
+ * @param  timeout_ms  The longest to sleep; 0 for no limit
+ */
+static void wait_for_notify(int timeout_ms)
+{
+#ifdef __APPLE__
+	uint64_t deadline = monotonic_ns() + (uint64_t) timeout_ms * 1000000ULL, left;
+#endif
+	struct timespec ts;
+	int timed_out = 0;
+	
+	if (g_notify_do)
+		return;
+	
+#ifndef __APPLE__
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+#endif
+	
+	while (!g_notify_do && !timed_out) {
+		if (timeout_ms == 0) {
+			pthread_cond_wait(&g_notify_cond, &g_notify_mutex);
+		} else {
+#ifdef __APPLE__
+			// a relative wait, recomputed after each wakeup, stands in for the monotonic clock
+			left = monotonic_ns();
+			left = left < deadline ? deadline - left : 0;
+			ts.tv_sec = (time_t) (left / 1000000000ULL);
+			ts.tv_nsec = (long) (left % 1000000000ULL);
+			timed_out = pthread_cond_timedwait_relative_np(&g_notify_cond, &g_notify_mutex, &ts) == ETIMEDOUT;
+#else
+			timed_out = pthread_cond_timedwait(&g_notify_cond, &g_notify_mutex, &ts) == ETIMEDOUT;
+#endif
+		}
+		
+		g_loop_stats.wakeups++;
+		if (g_notify_do)
+			g_loop_stats.notified++;
+		else if (timed_out)
+			g_loop_stats.timeouts++;
+		else
+			g_loop_stats.spurious++;
+	}
+}
+
+#ifdef __linux__
+/**
+ * Answer a command from the control socket
+ *
+ * @param  command   The line sent, without the newline
+ * @param  userdata  Unused
+ * @return The reply
+ */
+static const char *control_command(const char *command, void *userdata)
+{
+	static char reply[128];
+	
+	if (strcmp(command, "status") == 0) {
+		snprintf(reply, sizeof(reply), "%s, %d moves sent", g_state_names[g_state],
+				 g_plan != NULL ? sort_plan_moves_sent(g_plan) : g_sort_report.num_moves);
+		return reply;
+	}
+	if (strcmp(command, "quit") == 0) {
+		g_stop_requested = 1;
+		return "stopping";
+	}
+	return "unknown command; try status or quit";
+}
+#endif
+
+/**
+ * Sleep until there is something for the main loop to do, on whichever
+ * loop was chosen
+ *
+ * @param  timeout_ms  The longest to sleep; 0 for no limit
+ */
+static void wait_for_events(int timeout_ms)
+{
+	uint64_t started = monotonic_ns(), cpu = process_cpu_ns();
+#ifdef __linux__
+	int woken;
+	
+	if (g_event_loop != NULL) {
+		woken = event_loop_wait(g_event_loop, timeout_ms);
+		g_loop_stats.wakeups++;
+		if (woken & EVENT_NOTIFIED)
+			g_loop_stats.notified++;
+		else if (woken & EVENT_TIMEOUT)
+			g_loop_stats.timeouts++;
+		else
+			g_loop_stats.requests++;
+		if (woken & EVENT_SIGNAL)
+			g_stop_requested = 1;
+	} else
+#endif
+	{
+		pthread_mutex_lock(&g_notify_mutex);
+		wait_for_notify(timeout_ms);
+		g_notify_do = 0;
+		pthread_mutex_unlock(&g_notify_mutex);
+	}
+	
+	g_loop_stats.idle_ns += monotonic_ns() - started;
+	g_loop_stats.idle_cpu_ns += process_cpu_ns() - cpu;
+}
+/* -----------------------------  END MAIN LOOP  --------------------------- */
+
+
+/* ---------------------------------  TIMINGS  ----------------------------- */
+/**
+ * Print how long each phase of the run took to stderr
+ *
+ * @param  total  The whole run
+ */
+static void print_timings(const phase_report *total)
+{
+	int i;
+	
+	print_phase(stderr, NULL, NULL);
+	print_phase(stderr, "login", &g_login_phase);
+	print_phase(stderr, "load", &g_load_phase);
+	for (i = 0; i < NUM_SORT_PHASES; ++i) {
+		print_phase(stderr, sort_phase_names[i], &g_sort_report.phases[i]);
+	}
+	print_phase(stderr, "total", total);
+	fprintf(stderr, "main loop: %d wakeups (%d notified, %d timed out, %d spurious, %d requests), idle %.1f ms using %.1f ms CPU\n",
+			g_loop_stats.wakeups, g_loop_stats.notified, g_loop_stats.timeouts, g_loop_stats.spurious, g_loop_stats.requests,
+			g_loop_stats.idle_ns / 1000000.0, g_loop_stats.idle_cpu_ns / 1000000.0);
+}
+
+/**
+ * Write the phase timings and counts of the run as JSON
+ *
+ * @param  path   The file to write
+ * @param  total  The whole run
+ */
+static void write_timings(const char *path, const phase_report *total)
+{
+	FILE *file = fopen(path, "w");
+	int i;
+	
+	if (file == NULL) {
+		fprintf(stderr, "Cannot write timings to %s: %s\n", path, strerror(errno));
+		return;
+	}
+	
+	fprintf(file, "{\n");
+	fprintf(file, "  \"entries\": %d,\n", g_sort_report.num_entries);
+	fprintf(file, "  \"folders\": %d,\n", g_sort_report.num_folders);
+	fprintf(file, "  \"sorted_folders\": %d,\n", g_sort_report.num_sorted_folders);
+	fprintf(file, "  \"comparisons\": %llu,\n", (unsigned long long) g_sort_report.comparisons);
+	fprintf(file, "  \"moves\": %d,\n", g_sort_report.num_moves);
+	fprintf(file, "  \"load\": { \"playlists\": %d, \"waited\": %d, \"pending\": %d, "
+			"\"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f },\n",
+			g_load_report.num_playlists, g_load_report.num_waited, g_load_report.num_pending,
+			g_load_report.p50_ms, g_load_report.p90_ms, g_load_report.p99_ms, g_load_report.max_ms);
+	fprintf(file, "  \"dispatch\": { \"batches\": %d, \"largest_batch\": %d, \"unacked\": %d, "
+			"\"p50_ms\": %.3f, \"max_ms\": %.3f },\n",
+			g_dispatch_report.num_batches, g_dispatch_report.largest_batch, g_dispatch_report.num_unacked,
+			g_dispatch_report.p50_ms, g_dispatch_report.max_ms);
+	fprintf(file, "  \"main_loop\": { \"wakeups\": %d, \"notified\": %d, \"timeouts\": %d, \"spurious\": %d, \"requests\": %d, "
+			"\"idle_ms\": %.3f, \"idle_cpu_ms\": %.3f },\n",
+			g_loop_stats.wakeups, g_loop_stats.notified, g_loop_stats.timeouts, g_loop_stats.spurious, g_loop_stats.requests,
+			g_loop_stats.idle_ns / 1000000.0, g_loop_stats.idle_cpu_ns / 1000000.0);
+	fprintf(file, "  \"phases\": {\n    ");
+	write_phase_json(file, "login", &g_login_phase);
+	fprintf(file, ",\n    ");
+	write_phase_json(file, "load", &g_load_phase);
+	for (i = 0; i < NUM_SORT_PHASES; ++i) {
+		fprintf(file, ",\n    ");
+		write_phase_json(file, sort_phase_names[i], &g_sort_report.phases[i]);
+	}
+	fprintf(file, ",\n    ");
+	write_phase_json(file, "total", total);
+	fprintf(file, "\n  }\n}\n");
+	
+	fclose(file);
+}
+/* -------------------------------  END TIMINGS  --------------------------- */
+
+
 /**
  * Show usage information
  *
@@ -152,9 +801,58 @@ static sp_session_config spconfig = {
  */
 static void usage(const char *progname)
 {
-	fprintf(stderr, "usage: %s -u <username> -p <password>\n", progname);
+	fprintf(stderr, "usage: %s -u <username> -p <password> [options]\n", progname);
+	fprintf(stderr, "  -e, --engine natural|merge|radix|insert\n");
+	fprintf(stderr, "                            sort engine for playlist names (default: natural)\n");
+	fprintf(stderr, "  -j, --threads N           sort folders on N threads (default: 1)\n");
+	fprintf(stderr, "  -n, --dry-run             print the sorted container without changing it\n");
+	fprintf(stderr, "  -w, --load-timeout SECS   wait this long for playlists to load (default: 300)\n");
+	fprintf(stderr, "  -d, --daemon              stay logged in and keep the container sorted as it changes\n");
+	fprintf(stderr, "  -D, --debounce MS         place changes once none have come for MS ms (default: 2000)\n");
+	fprintf(stderr, "  -b, --batch N             send at most N moves between rounds of events (default: 256)\n");
+	fprintf(stderr, "  -S, --snapshot-dir DIR    keep the snapshot of the sorted container in DIR (default: %s)\n", CACHE_LOCATION);
+	fprintf(stderr, "  -F, --full                sort the whole container, not just what changed since the last run\n");
+	fprintf(stderr, "  -r, --progress-rate N     redraw the progress line N times a second (default: 4)\n");
+	fprintf(stderr, "  -t, --timings FILE        write how long each phase took to FILE as JSON\n");
+	fprintf(stderr, "  -T, --trace FILE          write a timeline of the run to FILE for chrome://tracing\n");
+#ifdef __linux__
+	fprintf(stderr, "  -E, --event-loop condvar|epoll\n");
+	fprintf(stderr, "                            how the main loop waits (default: condvar)\n");
+	fprintf(stderr, "  -C, --control SOCKET      take status and quit commands on this Unix socket (implies epoll)\n");
+#endif
 }
 
+/**
+ * The command line options
+ */
+static struct option long_options[] = {
+	{ "username",      required_argument, NULL, 'u' },
+	{ "password",      required_argument, NULL, 'p' },
+	{ "engine",        required_argument, NULL, 'e' },
+	{ "threads",       required_argument, NULL, 'j' },
+	{ "dry-run",       no_argument,       NULL, 'n' },
+	{ "load-timeout",  required_argument, NULL, 'w' },
+	{ "daemon",        no_argument,       NULL, 'd' },
+	{ "debounce",      required_argument, NULL, 'D' },
+	{ "batch",         required_argument, NULL, 'b' },
+	{ "snapshot-dir",  required_argument, NULL, 'S' },
+	{ "full",          no_argument,       NULL, 'F' },
+	{ "progress-rate", required_argument, NULL, 'r' },
+	{ "timings",       required_argument, NULL, 't' },
+	{ "trace",         required_argument, NULL, 'T' },
+#ifdef __linux__
+	{ "event-loop",    required_argument, NULL, 'E' },
+	{ "control",       required_argument, NULL, 'C' },
+#endif
+	{ NULL, 0, NULL, 0 }
+};
+
+#ifdef __linux__
+#define LINUX_OPTIONS "E:C:"
+#else
+#define LINUX_OPTIONS ""
+#endif
+
 static void trim(char *buf)
 {
 	size_t l = strlen(buf);
@@ -171,8 +869,12 @@ int main(int argc, char **argv)
 	const char *password = NULL;
 	char username_buf[256];
 	int opt;
+	stopwatch run;
+	phase_report total = { 0 };
+	const char *trace_path = NULL;
+	uint64_t started;
 	
-	while ((opt = getopt(argc, argv, "u:p:")) != EOF) {
+	while ((opt = getopt_long(argc, argv, "u:p:e:j:nw:dD:b:S:Fr:t:T:" LINUX_OPTIONS, long_options, NULL)) != EOF) {
 		switch (opt) {
 			case 'u':
 				username = optarg;
@@ -182,6 +884,103 @@ int main(int argc, char **argv)
 				password = optarg;
 				break;
 				
+			case 'e':
+				if (strcmp(optarg, "natural") == 0) {
+					g_sort_options.engine = SORT_ENGINE_NATURAL;
+				} else if (strcmp(optarg, "merge") == 0) {
+					g_sort_options.engine = SORT_ENGINE_MERGE;
+				} else if (strcmp(optarg, "radix") == 0) {
+					g_sort_options.engine = SORT_ENGINE_RADIX;
+				} else if (strcmp(optarg, "insert") == 0) {
+					g_sort_options.engine = SORT_ENGINE_INSERT;
+				} else {
+					usage(basename(argv[0]));
+					exit(1);
+				}
+				break;
+				
+			case 'j':
+				g_sort_options.threads = atoi(optarg);
+				if (g_sort_options.threads < 1) {
+					usage(basename(argv[0]));
+					exit(1);
+				}
+				break;
+				
+			case 'n':
+				g_sort_options.dry_run = 1;
+				break;
+				
+			case 'w':
+				g_load_timeout = atoi(optarg);
+				if (g_load_timeout < 1) {
+					usage(basename(argv[0]));
+					exit(1);
+				}
+				break;
+				
+			case 'd':
+				g_daemon = 1;
+				break;
+				
+			case 'D':
+				g_debounce_ms = atoi(optarg);
+				if (g_debounce_ms < 0) {
+					usage(basename(argv[0]));
+					exit(1);
+				}
+				break;
+				
+			case 'b':
+				g_max_batch = atoi(optarg);
+				if (g_max_batch < 1) {
+					usage(basename(argv[0]));
+					exit(1);
+				}
+				break;
+				
+			case 'S':
+				g_snapshot_dir = optarg;
+				break;
+				
+			case 'F':
+				g_full_sort = 1;
+				break;
+				
+			case 'r':
+				g_sort_options.progress_rate = atoi(optarg);
+				if (g_sort_options.progress_rate < 0) {
+					usage(basename(argv[0]));
+					exit(1);
+				}
+				break;
+				
+			case 't':
+				g_timings_path = optarg;
+				break;
+				
+			case 'T':
+				trace_path = optarg;
+				break;
+				
+#ifdef __linux__
+			case 'E':
+				if (strcmp(optarg, "condvar") == 0) {
+					g_use_epoll = 0;
+				} else if (strcmp(optarg, "epoll") == 0) {
+					g_use_epoll = 1;
+				} else {
+					usage(basename(argv[0]));
+					exit(1);
+				}
+				break;
+				
+			case 'C':
+				g_control_path = optarg;
+				g_use_epoll = 1;
+				break;
+#endif
+				
 			default:
 				usage(basename(argv[0]));
 				exit(1);
@@ -204,6 +1003,25 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 	
+	if (trace_path != NULL) {
+		if (!open_trace(trace_path)) {
+			fprintf(stderr, "Cannot write trace to %s: %s\n", trace_path, strerror(errno));
+			exit(1);
+		}
+		trace_thread_name("main");
+	}
+	
+#ifdef __linux__
+	// before the session, so libspotify's threads inherit the blocked signals
+	if (g_use_epoll) {
+		g_event_loop = create_event_loop(g_control_path, control_command, NULL);
+		if (g_event_loop == NULL) {
+			fprintf(stderr, "Cannot set up the epoll loop: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+#endif
+	
 	/* Create session */
 	spconfig.application_key_size = g_appkey_size;
 	
@@ -215,44 +1033,46 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 	
-	pthread_mutex_init(&g_notify_mutex, NULL);
-	pthread_cond_init(&g_notify_cond, NULL);
+	init_notify();
 	
+	start_stopwatch(&run);
+	start_stopwatch(&g_watch);
 	sp_session_login(sp, username, password);
-	pthread_mutex_lock(&g_notify_mutex);
 	
-	g_quit = 0;
-	
-	while(!g_quit) {
+	while(g_state != RUN_LOGGED_OUT) {
 		
-		if (next_timeout == 0) {
-			while(!g_notify_do)
-				pthread_cond_wait(&g_notify_cond, &g_notify_mutex);
-		} else {
-			struct timespec ts;
-			
-#if _POSIX_TIMERS > 0
-			clock_gettime(CLOCK_REALTIME, &ts);
-#else
-			struct timeval tv;
-			gettimeofday(&tv, NULL);
-			TIMEVAL_TO_TIMESPEC(&tv, &ts);
-#endif
-			ts.tv_sec += next_timeout / 1000;
-			ts.tv_nsec += (next_timeout % 1000) * 1000000;
-			
-			pthread_cond_timedwait(&g_notify_cond, &g_notify_mutex, &ts);
+		// the next batch of moves can go after just another round of events
+		if (g_state != RUN_PLANNED || !dispatch_ready(g_dispatch)) {
+			started = tracing() ? monotonic_ns() : 0;
+			wait_for_events(loop_timeout_ms(next_timeout));
+			if (started != 0) {
+				trace_span("main loop", "wait", started, monotonic_ns());
+			}
 		}
 		
-		g_notify_do = 0;
-		pthread_mutex_unlock(&g_notify_mutex);
-		
 		do {
+			started = tracing() ? monotonic_ns() : 0;
 			sp_session_process_events(sp, &next_timeout);
+			if (started != 0) {
+				trace_span("main loop", "sp_session_process_events", started, monotonic_ns());
+			}
 		} while (next_timeout == 0);
 		
-		pthread_mutex_lock(&g_notify_mutex);
+		advance(sp);
+	}
+	
+#ifdef __linux__
+	free_event_loop(g_event_loop);
+#endif
+	
+	started = run.wall_ns;
+	stop_phase(&run, &total);
+	trace_span("phase", "total", started, run.wall_ns);
+	close_trace();
+	print_timings(&total);
+	if (g_timings_path != NULL) {
+		write_timings(g_timings_path, &total);
 	}
 	
-	return 0;
+	return g_exit_status;
 }
@@ -21,254 +21,1459 @@
  *
  */
 
-// #define TESTING
-
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <limits.h>
 
 #include <libspotify/api.h>
 
 #include "playlist.h"
+#include "taskpool.h"
+#include "timing.h"
+#include "simcontainer.h"
+#include "trace.h"
+#include "progress.h"
+#include "positions.h"
 
-typedef struct s_playlist_item {
-	int index;
-	int end_index; // for folders
-	const char *name;	
-} playlist_item;
+/*
+ * Playlist names are copied into one growing buffer and referred to by
+ * offset, so they cost no allocation of their own. When interning is on,
+ * repeated names (every "New Playlist") share a single copy.
+ */
+
+#define NO_STRING ((uint32_t) -1)
+
+typedef struct s_interned_name {
+	uint32_t hash;
+	uint32_t offset; // NO_STRING if the entry is empty
+	uint32_t length;
+} interned_name;
+
+typedef struct s_string_arena {
+	char *data;
+	uint32_t size;
+	uint32_t capacity;
+	
+	interned_name *table; // NULL unless interning
+	uint32_t table_size;
+	uint32_t num_interned;
+} string_arena;
+
+/*
+ * The playlist tree lives in a single array of nodes, linked by 32-bit
+ * indexes rather than pointers. Node 0 is the root, whose children are the
+ * top level of the container.
+ */
+
+#define NO_NODE ((uint32_t) -1)
+#define ROOT_NODE 0
+
+// node flags, set by mark_sorted() or mark_changed()
+#define NODE_SORTED         0x1 // children are already in order
+#define NODE_SUBTREE_SORTED 0x2 // so are the children of every folder below
+#define NODE_CONTIGUOUS     0x4 // no placeholders between start and end
+#define NODE_CHANGED        0x8 // to be placed among its siblings; see place_changed()
 
 typedef struct s_node {
-	struct s_node *next;
+	uint32_t next;
 	
-	struct s_node *children;
-	struct s_node *parent;
+	uint32_t children;
+	uint32_t parent;
 	
-	playlist_item *item;
+	int index;
+	int end_index; // for folders
+	uint32_t flags;
+	
+	uint64_t key; // first KEY_PREFIX_LENGTH bytes of the name, big-endian
+	uint32_t name; // offset into the string arena
+	uint32_t name_length;
 } node;
 
+typedef struct s_sort_stats {
+	uint64_t comparisons;
+	uint64_t prefix_comparisons; // decided by the key prefix alone
+	char padding[48]; // one cache line per sorting thread
+} sort_stats;
+
+typedef struct s_tree {
+	node *nodes;
+	uint32_t num_nodes;
+	uint32_t capacity;
+	
+	string_arena names;
+} tree;
 
-/** Node operations **/
 
-static node *create_node(node *previous, node *parent, playlist_item *item) {
-	node *new_node = (node *)malloc(sizeof(node));
+/** String arena operations **/
+
+static uint32_t hash_name(const char *name, uint32_t length) {
+	uint32_t hash = 2166136261u; // FNV-1a
+	uint32_t i;
+	
+	for(i = 0; i < length; ++i) {
+		hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+	}
 	
-	new_node->item = item;
+	return hash;
+}
+
+static int create_string_arena(string_arena *sa, uint32_t capacity, int intern) {
+	uint32_t i;
 	
-	new_node->next = NULL;
+	sa->size = 0;
+	sa->capacity = capacity > 0 ? capacity : 64;
+	sa->data = (char *) malloc(sa->capacity);
 	
-	new_node->parent = parent;
-	new_node->children = NULL;
+	sa->table = NULL;
+	sa->table_size = 0;
+	sa->num_interned = 0;
 	
-	if(previous != NULL) {
-		previous->next = new_node;
+	if(sa->data == NULL) {
+		return 0;
 	}
 	
-	if(parent != NULL) {
-		if(parent->children == NULL) {
-			parent->children = new_node;
+	if(intern) {
+		for(sa->table_size = 64; sa->table_size < capacity / 8; sa->table_size *= 2)
+			;
+		sa->table = (interned_name *) malloc(sizeof(interned_name) * sa->table_size);
+		if(sa->table == NULL) {
+			free(sa->data);
+			return 0;
+		}
+		for(i = 0; i < sa->table_size; ++i) {
+			sa->table[i].offset = NO_STRING;
 		}
 	}
 	
-	return new_node;
+	return 1;
+}
+
+static void free_string_arena(string_arena *sa) {
+	free(sa->data);
+	free(sa->table);
+	sa->data = NULL;
+	sa->table = NULL;
+}
+
+static interned_name *find_interned(interned_name *table, uint32_t table_size, const char *data, const char *name, uint32_t length, uint32_t hash) {
+	uint32_t i;
+	
+	for(i = hash & (table_size - 1); table[i].offset != NO_STRING; i = (i + 1) & (table_size - 1)) {
+		if(table[i].hash == hash && table[i].length == length && memcmp(data + table[i].offset, name, length) == 0) {
+			break;
+		}
+	}
+	
+	return &table[i];
 }
 
-static void free_list(node *head) {
-	if (head->next != NULL) {
-		free_list(head->next);
+static int grow_interned(string_arena *sa) {
+	interned_name *table, *entry;
+	uint32_t i, table_size = sa->table_size * 2;
+	
+	table = (interned_name *) malloc(sizeof(interned_name) * table_size);
+	if(table == NULL) {
+		return 0;
 	}
-	if (head->children != NULL) {
-		free_list(head->children);
+	for(i = 0; i < table_size; ++i) {
+		table[i].offset = NO_STRING;
 	}
-	if (head->item != NULL) {
-		if(head->item->name != NULL) {
-			free((void *)head->item->name);
+	
+	for(i = 0; i < sa->table_size; ++i) {
+		if(sa->table[i].offset != NO_STRING) {
+			entry = &table[sa->table[i].hash & (table_size - 1)];
+			while(entry->offset != NO_STRING) {
+				entry = (entry == &table[table_size - 1]) ? table : entry + 1;
+			}
+			*entry = sa->table[i];
 		}
-		free(head->item);
 	}
-	free(head);
+	
+	free(sa->table);
+	sa->table = table;
+	sa->table_size = table_size;
+	return 1;
 }
 
-static void print_list(node *head) {
+/*
+ * Copy a name into the arena, NUL terminated, and return its offset.
+ * Returns NO_STRING if the arena could not grow.
+ */
+static uint32_t add_string(string_arena *sa, const char *name, uint32_t *length) {
+	interned_name *entry = NULL;
+	uint32_t offset, hash = 0;
+	char *data;
 	
-	playlist_item *item = head->item;
+	*length = (uint32_t) strlen(name);
 	
-	printf("%03d (%03d) %s\n", item->index, item->end_index, item->name);
-	printf("  next:     %s\n", head->next     == NULL? "null" : head->next->item->name);
-	printf("  parent:   %s\n", head->parent   == NULL? "null" : head->parent->item->name);
-	printf("  children: %s\n", head->children == NULL? "null" : head->children->item->name);
+	if(sa->table != NULL) {
+		hash = hash_name(name, *length);
+		entry = find_interned(sa->table, sa->table_size, sa->data, name, *length, hash);
+		if(entry->offset != NO_STRING) {
+			return entry->offset;
+		}
+	}
+	
+	while(sa->capacity - sa->size < *length + 1) {
+		data = (char *) realloc(sa->data, (size_t) sa->capacity * 2);
+		if(data == NULL) {
+			return NO_STRING;
+		}
+		sa->data = data;
+		sa->capacity *= 2;
+	}
+	
+	offset = sa->size;
+	memcpy(sa->data + offset, name, *length + 1);
+	sa->size += *length + 1;
 	
-	if(head->children != NULL) {
-		print_list(head->children);
+	if(entry != NULL) {
+		entry->hash = hash;
+		entry->offset = offset;
+		entry->length = *length;
+		// keep the table at most half full
+		if(++sa->num_interned * 2 > sa->table_size && !grow_interned(sa)) {
+			free(sa->table);
+			sa->table = NULL;
+		}
 	}
 	
-	if(head->next != NULL) {
-		print_list(head->next);
+	return offset;
+}
+
+#define NODE_NAME(t, n) ((t)->names.data + (t)->nodes[n].name)
+
+
+/** Sort keys **/
+
+/*
+ * Names sort by their bytes, exactly as strcmp() orders them. The first
+ * bytes are packed big-endian into an integer held in the node, so most
+ * comparisons are a single integer compare; only names sharing the whole
+ * prefix fall back to the rest of the name in the string arena.
+ */
+
+#define KEY_PREFIX_LENGTH 8
+
+static uint64_t key_prefix(const char *name, uint32_t length) {
+	uint64_t key = 0;
+	uint32_t i;
+	
+	for(i = 0; i < KEY_PREFIX_LENGTH; ++i) {
+		key = (key << 8) | (i < length ? (unsigned char) name[i] : 0);
 	}
 	
+	return key;
+}
+
+static int compare_nodes(const tree *t, sort_stats *stats, uint32_t a, uint32_t b) {
+	const node *x = &t->nodes[a];
+	const node *y = &t->nodes[b];
+	uint32_t length;
+	int result;
+	
+	++stats->comparisons;
+	
+	if(x->key != y->key) {
+		++stats->prefix_comparisons;
+		return x->key < y->key ? -1 : 1;
+	}
+	
+	if(x->name_length <= KEY_PREFIX_LENGTH || y->name_length <= KEY_PREFIX_LENGTH) {
+		// names without NUL bytes only share a padded prefix if the shorter is a prefix
+		++stats->prefix_comparisons;
+		return x->name_length < y->name_length ? -1 : x->name_length > y->name_length;
+	}
+	
+	length = x->name_length < y->name_length ? x->name_length : y->name_length;
+	result = memcmp(NODE_NAME(t, a) + KEY_PREFIX_LENGTH, NODE_NAME(t, b) + KEY_PREFIX_LENGTH, length - KEY_PREFIX_LENGTH);
+	if(result != 0) {
+		return result;
+	}
+	return x->name_length < y->name_length ? -1 : x->name_length > y->name_length;
+}
+
+
+/** Node operations **/
+
+static int create_tree(tree *t, int num_playlists, int intern_names) {
+	// every entry but the end of a folder needs a node, plus one for the root
+	t->capacity = (uint32_t) num_playlists + 1;
+	t->nodes = (node *) malloc(sizeof(node) * t->capacity);
+	if(t->nodes == NULL) {
+		return 0;
+	}
+	
+	// a guess at the typical name length; the arena grows if it is wrong
+	if(!create_string_arena(&t->names, t->capacity * 24, intern_names)) {
+		free(t->nodes);
+		return 0;
+	}
+	
+	t->num_nodes = 1;
+	t->nodes[ROOT_NODE].next = NO_NODE;
+	t->nodes[ROOT_NODE].children = NO_NODE;
+	t->nodes[ROOT_NODE].parent = NO_NODE;
+	t->nodes[ROOT_NODE].index = -1;
+	t->nodes[ROOT_NODE].end_index = -1;
+	t->nodes[ROOT_NODE].flags = 0;
+	t->nodes[ROOT_NODE].name = add_string(&t->names, "", &t->nodes[ROOT_NODE].name_length);
+	t->nodes[ROOT_NODE].key = 0;
+	
+	return 1;
+}
+
+static uint32_t create_node(tree *t, uint32_t previous, uint32_t parent, int index, const char *name) {
+	uint32_t new_node = t->num_nodes;
+	node *n = &t->nodes[new_node];
+	
+	n->name = add_string(&t->names, name, &n->name_length);
+	if(n->name == NO_STRING) {
+		return NO_NODE;
+	}
+	n->key = key_prefix(name, n->name_length);
+	++t->num_nodes;
+	
+	n->index = index;
+	n->end_index = -1;
+	n->flags = 0;
+	
+	n->next = NO_NODE;
+	
+	n->parent = parent;
+	n->children = NO_NODE;
+	
+	if(previous != NO_NODE) {
+		t->nodes[previous].next = new_node;
+	} else {
+		t->nodes[parent].children = new_node;
+	}
+	
+	return new_node;
+}
+
+static void free_tree(tree *t) {
+	free_string_arena(&t->names);
+	free(t->nodes);
+	t->nodes = NULL;
+	t->num_nodes = 0;
 }
 
 /** Merge sort **/
 
-static node *merge(node *head_one, node *head_two);
+/*
+ * Bottom-up merge sort: runs of width 1, 2, 4, ... are merged in place by
+ * relinking, so no recursion is needed however long the list is. Ties keep
+ * their original order.
+ */
 
-static node *merge_sort(node *head) {
-	node *head_one;
-	node *head_two;
+static uint32_t split_list(node *nodes, uint32_t head, int length) {
+	uint32_t rest;
 	
-	if((head == NULL) || (head->next == NULL)) 
-		return head;
+	for(; head != NO_NODE && length > 1; --length) {
+		head = nodes[head].next;
+	}
+	
+	if(head == NO_NODE) {
+		return NO_NODE;
+	}
+	
+	rest = nodes[head].next;
+	nodes[head].next = NO_NODE;
+	return rest;
+}
+
+static uint32_t merge(tree *t, sort_stats *stats, uint32_t head_one, uint32_t head_two, uint32_t *tail) {
+	node *nodes = t->nodes;
+	uint32_t head = NO_NODE;
+	uint32_t *link = &head;
+	
+	while((head_one != NO_NODE) && (head_two != NO_NODE)) {
+		if(compare_nodes(t, stats, head_two, head_one) < 0) {
+			*link = head_two;
+			head_two = nodes[head_two].next;
+		} else {
+			*link = head_one;
+			head_one = nodes[head_one].next;
+		}
+		*tail = *link;
+		link = &nodes[*link].next;
+	}
+	
+	*link = (head_one != NO_NODE) ? head_one : head_two;
+	while(*link != NO_NODE) {
+		*tail = *link;
+		link = &nodes[*link].next;
+	}
+	
+	return head;
+}
+
+static uint32_t merge_sort(tree *t, sort_stats *stats, uint32_t head) {
+	node *nodes = t->nodes;
+	uint32_t list, n, merged_tail, head_one, head_two, rest;
+	uint32_t *link;
+	int length = 0, width;
+	
+	for(n = head; n != NO_NODE; n = nodes[n].next) {
+		++length;
+	}
+	
+	list = head;
+	for(width = 1; width < length; width *= 2) {
+		link = &list;
+		rest = list;
+		while(rest != NO_NODE) {
+			head_one = rest;
+			head_two = split_list(nodes, head_one, width);
+			rest = split_list(nodes, head_two, width);
+			*link = merge(t, stats, head_one, head_two, &merged_tail);
+			link = &nodes[merged_tail].next;
+		}
+	}
+	
+	return list;
+}
+
+/** Natural merge sort **/
+
+/*
+ * Adaptive merge sort in the manner of Timsort. The list is copied to an
+ * array and cut into the ascending runs it already contains (strictly
+ * descending runs are reversed, which keeps ties in order), and runs are
+ * merged as they are found while their lengths on the stack keep Timsort's
+ * invariants. A merge first skips what is in place at either end by an
+ * exponential search, then takes one entry at a time until a run wins
+ * MIN_GALLOP times in a row, and from there gallops: an exponential search
+ * finds how many entries in a row come from that run. A sorted list is a
+ * single run and costs n - 1 comparisons; a sorted list with k entries
+ * out of place costs about n + k log n.
+ */
+
+#define MAX_RUNS 64 // run lengths on the stack grow faster than Fibonacci
+#define MIN_GALLOP 7
+
+typedef struct s_run {
+	uint32_t start;
+	uint32_t length;
+} run;
+
+typedef struct s_merge_state {
+	const tree *t;
+	sort_stats *stats;
+	uint32_t *items;
+	uint32_t *scratch;   // room for the shorter run of each merge
+	uint32_t min_gallop; // wins in a row before galloping; lowered while galloping pays
+} merge_state;
+
+/// Whether x stays before key in a merge; ties_before for when they are equal
+static int stays_before(merge_state *ms, uint32_t x, uint32_t key, int ties_before) {
+	int result = compare_nodes(ms->t, ms->stats, x, key);
+	
+	return result < 0 || (ties_before && result == 0);
+}
+
+/// How many of the entries, which are in order, stay before key; searches out from hint in steps that double
+static uint32_t gallop(merge_state *ms, uint32_t key, const uint32_t *items, uint32_t length, uint32_t hint, int ties_before) {
+	uint32_t lo, hi, mid, last = 0, step = 1;
+	
+	if(stays_before(ms, items[hint], key, ties_before)) {
+		while(step < length - hint && stays_before(ms, items[hint + step], key, ties_before)) {
+			last = step;
+			step = step * 2 + 1;
+		}
+		if(step > length - hint) {
+			step = length - hint;
+		}
+		lo = hint + last + 1;
+		hi = hint + step;
+	} else {
+		while(step <= hint && !stays_before(ms, items[hint - step], key, ties_before)) {
+			last = step;
+			step = step * 2 + 1;
+		}
+		if(step > hint + 1) {
+			step = hint + 1;
+		}
+		lo = hint + 1 - step;
+		hi = hint - last;
+	}
+	
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if(stays_before(ms, items[mid], key, ties_before)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/// Go on galloping if it took min_gallop or more entries at a time, otherwise make it harder to start again
+static int keep_galloping(merge_state *ms, uint32_t taken_a, uint32_t taken_b) {
+	if(taken_a >= MIN_GALLOP || taken_b >= MIN_GALLOP) {
+		if(ms->min_gallop > 1) {
+			--ms->min_gallop;
+		}
+		return 1;
+	}
+	++ms->min_gallop;
+	return 0;
+}
+
+/// Merge the runs of na and nb entries at start, na being the shorter, from the front
+static void merge_lo(merge_state *ms, uint32_t start, uint32_t na, uint32_t nb) {
+	uint32_t *items = ms->items, *a = ms->scratch;
+	uint32_t i = 0, j = start + na, end = start + na + nb, dest = start;
+	uint32_t wins_a = 0, wins_b = 0, taken_a, taken_b;
+	
+	memcpy(a, items + start, sizeof(uint32_t) * na);
+	while(i < na && j < end) {
+		if(wins_a < ms->min_gallop && wins_b < ms->min_gallop) {
+			if(compare_nodes(ms->t, ms->stats, items[j], a[i]) < 0) {
+				items[dest++] = items[j++];
+				++wins_b;
+				wins_a = 0;
+			} else {
+				items[dest++] = a[i++];
+				++wins_a;
+				wins_b = 0;
+			}
+			continue;
+		}
+		
+		// the entries of a that go before the next of b, then that one
+		taken_a = gallop(ms, items[j], a + i, na - i, 0, 1);
+		memcpy(items + dest, a + i, sizeof(uint32_t) * taken_a);
+		dest += taken_a;
+		i += taken_a;
+		if(i == na) {
+			break;
+		}
+		items[dest++] = items[j++];
+		if(j == end) {
+			break;
+		}
+		
+		// the entries of b that go before the next of a, then that one
+		taken_b = gallop(ms, a[i], items + j, end - j, 0, 0);
+		memmove(items + dest, items + j, sizeof(uint32_t) * taken_b);
+		dest += taken_b;
+		j += taken_b;
+		if(j == end) {
+			break;
+		}
+		items[dest++] = a[i++];
+		
+		if(!keep_galloping(ms, taken_a, taken_b)) {
+			wins_a = wins_b = 0;
+		}
+	}
+	
+	// whatever is left of b is in place already
+	memcpy(items + dest, a + i, sizeof(uint32_t) * (na - i));
+}
+
+/// Merge the runs of na and nb entries at start, nb being the shorter, from the back
+static void merge_hi(merge_state *ms, uint32_t start, uint32_t na, uint32_t nb) {
+	uint32_t *items = ms->items, *b = ms->scratch;
+	uint32_t i = na, j = nb, dest = start + na + nb; // i and j entries of a and b are left
+	uint32_t wins_a = 0, wins_b = 0, taken_a, taken_b;
 	
-	head_one = head;
-	head_two = head->next;
-	while((head_two != NULL) && (head_two->next != NULL)) {
-		head = head->next;
-		head_two = head->next->next;
+	memcpy(b, items + start + na, sizeof(uint32_t) * nb);
+	while(i > 0 && j > 0) {
+		if(wins_a < ms->min_gallop && wins_b < ms->min_gallop) {
+			if(compare_nodes(ms->t, ms->stats, b[j - 1], items[start + i - 1]) < 0) {
+				items[--dest] = items[start + --i];
+				++wins_a;
+				wins_b = 0;
+			} else {
+				items[--dest] = b[--j];
+				++wins_b;
+				wins_a = 0;
+			}
+			continue;
+		}
+		
+		// the entries of a that go after the last of b, then that one
+		taken_a = i - gallop(ms, b[j - 1], items + start, i, i - 1, 1);
+		dest -= taken_a;
+		i -= taken_a;
+		memmove(items + dest, items + start + i, sizeof(uint32_t) * taken_a);
+		if(i == 0) {
+			break;
+		}
+		items[--dest] = b[--j];
+		if(j == 0) {
+			break;
+		}
+		
+		// the entries of b that go after the last of a, then that one
+		taken_b = j - gallop(ms, items[start + i - 1], b, j, j - 1, 0);
+		dest -= taken_b;
+		j -= taken_b;
+		memcpy(items + dest, b + j, sizeof(uint32_t) * taken_b);
+		if(j == 0) {
+			break;
+		}
+		items[--dest] = items[start + --i];
+		
+		if(!keep_galloping(ms, taken_a, taken_b)) {
+			wins_a = wins_b = 0;
+		}
 	}
-	head_two = head->next;
-	head->next = NULL;
 	
-	return merge(merge_sort(head_one), merge_sort(head_two));
+	// whatever is left of a is in place already
+	memcpy(items + start, b, sizeof(uint32_t) * j);
 }
 
-static node *merge(node *head_one, node *head_two) {
-	node *head_three;
+static void merge_runs(merge_state *ms, run *runs, int i) {
+	uint32_t *items = ms->items;
+	uint32_t start = runs[i].start, na = runs[i].length, nb = runs[i + 1].length, skipped;
 	
-	if(head_one == NULL) 
-		return head_two;
+	runs[i].length = na + nb;
 	
-	if(head_two == NULL) 
-		return head_one;
+	// the front of a that goes before all of b, and the back of b that goes after all of a, stay put
+	skipped = gallop(ms, items[start + na], items + start, na, 0, 1);
+	start += skipped;
+	na -= skipped;
+	if(na == 0) {
+		return;
+	}
+	nb = gallop(ms, items[start + na - 1], items + start + na, nb, nb - 1, 0);
+	if(nb == 0) {
+		return;
+	}
 	
-	if(strcmp(head_one->item->name, head_two->item->name) < 0) {
-		head_three = head_one;
-		head_three->next = merge(head_one->next, head_two);
+	if(na <= nb) {
+		merge_lo(ms, start, na, nb);
 	} else {
-		head_three = head_two;
-		head_three->next = merge(head_one, head_two->next);
+		merge_hi(ms, start, na, nb);
+	}
+}
+
+/// The length of the run at start, reversed first if it is descending
+static uint32_t next_run(merge_state *ms, uint32_t start, uint32_t length) {
+	uint32_t *items = ms->items;
+	uint32_t end = start + 1, lo, hi, swap;
+	
+	if(end < length && compare_nodes(ms->t, ms->stats, items[end - 1], items[end]) > 0) {
+		do {
+			++end;
+		} while(end < length && compare_nodes(ms->t, ms->stats, items[end - 1], items[end]) > 0);
+		
+		for(lo = start, hi = end - 1; lo < hi; ++lo, --hi) {
+			swap = items[lo];
+			items[lo] = items[hi];
+			items[hi] = swap;
+		}
+		return end - start;
 	}
 	
-	return head_three;
+	while(end < length && compare_nodes(ms->t, ms->stats, items[end - 1], items[end]) <= 0) {
+		++end;
+	}
+	return end - start;
 }
 
-static node *sort_list(node *head) {
-	node *n;
+static uint32_t natural_merge_sort(tree *t, sort_stats *stats, uint32_t head) {
+	merge_state ms;
+	run runs[MAX_RUNS];
+	uint32_t n, i, start, length = 0;
+	int num_runs = 0, r, m;
+	
+	for(n = head; n != NO_NODE; n = t->nodes[n].next) {
+		++length;
+	}
+	if(length < 2) {
+		return head;
+	}
+	
+	ms.t = t;
+	ms.stats = stats;
+	ms.min_gallop = MIN_GALLOP;
+	ms.items = (uint32_t *) malloc(sizeof(uint32_t) * (length + length / 2));
+	if(ms.items == NULL) {
+		return merge_sort(t, stats, head);
+	}
+	ms.scratch = ms.items + length;
+	
+	for(n = head, i = 0; n != NO_NODE; n = t->nodes[n].next) {
+		ms.items[i++] = n;
+	}
 	
-	for(n = head; n != NULL; n = n->next) {
-		if(n->children != NULL) {
-			n->children = sort_list(n->children);
+	start = 0;
+	while(start < length) {
+		runs[num_runs].start = start;
+		runs[num_runs].length = next_run(&ms, start, length);
+		start += runs[num_runs++].length;
+		
+		while((r = num_runs) > 1) {
+			if((r >= 3 && runs[r - 3].length <= runs[r - 2].length + runs[r - 1].length) ||
+			   (r >= 4 && runs[r - 4].length <= runs[r - 3].length + runs[r - 2].length)) {
+				m = runs[r - 3].length < runs[r - 1].length ? r - 3 : r - 2;
+			} else if(runs[r - 2].length <= runs[r - 1].length) {
+				m = r - 2;
+			} else {
+				break;
+			}
+			
+			merge_runs(&ms, runs, m);
+			if(m == r - 3) {
+				runs[r - 2] = runs[r - 1];
+			}
+			--num_runs;
 		}
 	}
 	
-	return merge_sort(head);
+	while(num_runs > 1) {
+		merge_runs(&ms, runs, num_runs - 2);
+		--num_runs;
+	}
+	
+	for(i = 0; i + 1 < length; ++i) {
+		t->nodes[ms.items[i]].next = ms.items[i + 1];
+	}
+	t->nodes[ms.items[length - 1]].next = NO_NODE;
+	head = ms.items[0];
+	
+	free(ms.items);
+	return head;
 }
 
-/** Flatten for reordering **/
+/** Radix sort **/
 
-static void _flatten_list(node *head, int *reorder, int *idx) {
-	reorder[(*idx)++] = head->item->index;
+/*
+ * MSD radix sort over the name bytes. Each pass distributes a bucket by the
+ * byte at the current depth into a scratch array and copies it back, which
+ * keeps ties in their original order (an in-place American flag pass would
+ * not). Names contain no NUL bytes, so byte 0 marks names that have ended;
+ * those are all equal and need no further passes. Small buckets are
+ * finished with an insertion sort.
+ */
+
+#define RADIX_INSERTION_CUTOFF 32
+
+typedef struct s_radix_bucket {
+	uint32_t start;
+	uint32_t length;
+	uint32_t depth;
+} radix_bucket;
+
+static unsigned char name_byte(const tree *t, uint32_t n, uint32_t depth) {
+	const node *x = &t->nodes[n];
 	
-	if(head->children != NULL) {
-		_flatten_list(head->children, reorder, idx);
-		reorder[(*idx)++] = head->item->end_index;
+	if(depth < KEY_PREFIX_LENGTH) {
+		return (unsigned char) (x->key >> (8 * (KEY_PREFIX_LENGTH - 1 - depth)));
 	}
+	return depth < x->name_length ? (unsigned char) t->names.data[x->name + depth] : 0;
+}
+
+static void insertion_sort(const tree *t, sort_stats *stats, uint32_t *items, uint32_t length) {
+	uint32_t i, j, n;
 	
-	if(head->next != NULL) {
-		_flatten_list(head->next, reorder, idx);
+	for(i = 1; i < length; ++i) {
+		n = items[i];
+		for(j = i; j > 0 && compare_nodes(t, stats, n, items[j - 1]) < 0; --j) {
+			items[j] = items[j - 1];
+		}
+		items[j] = n;
 	}
 }
 
-static void flatten_list(node *head, int *reorder) {
-	int idx = 0;
-	_flatten_list(head, reorder, &idx);
-#ifdef TESTING
-	printf("Did %d iterations\n", idx + 1);
-#endif
+static void radix_sort_items(const tree *t, sort_stats *stats, uint32_t *items, uint32_t *scratch, radix_bucket *stack, uint32_t length) {
+	uint32_t counts[256];
+	uint32_t offsets[256];
+	uint32_t i, b, start, sp = 0;
+	radix_bucket bucket;
+	
+	stack[sp].start = 0;
+	stack[sp].length = length;
+	stack[sp].depth = 0;
+	++sp;
+	
+	while(sp > 0) {
+		bucket = stack[--sp];
+		
+		if(bucket.length < RADIX_INSERTION_CUTOFF) {
+			insertion_sort(t, stats, items + bucket.start, bucket.length);
+			continue;
+		}
+		
+		memset(counts, 0, sizeof(counts));
+		for(i = 0; i < bucket.length; ++i) {
+			++counts[name_byte(t, items[bucket.start + i], bucket.depth)];
+		}
+		
+		for(b = 0, start = 0; b < 256; ++b) {
+			offsets[b] = start;
+			start += counts[b];
+		}
+		for(i = 0; i < bucket.length; ++i) {
+			scratch[offsets[name_byte(t, items[bucket.start + i], bucket.depth)]++] = items[bucket.start + i];
+		}
+		memcpy(items + bucket.start, scratch, sizeof(uint32_t) * bucket.length);
+		
+		// buckets are disjoint and hold at least two items, so the stack never outgrows length
+		for(b = 1, start = bucket.start + counts[0]; b < 256; start += counts[b++]) {
+			if(counts[b] > 1) {
+				stack[sp].start = start;
+				stack[sp].length = counts[b];
+				stack[sp].depth = bucket.depth + 1;
+				++sp;
+			}
+		}
+	}
 }
 
-static void recalculate_indexes(int *reorder, int size, int moved) {
-	int original_index, i;
+static uint32_t radix_sort(tree *t, sort_stats *stats, uint32_t head) {
+	uint32_t *items, *scratch;
+	radix_bucket *stack;
+	uint32_t n, i, length = 0;
+	
+	for(n = head; n != NO_NODE; n = t->nodes[n].next) {
+		++length;
+	}
+	if(length < 2) {
+		return head;
+	}
 	
-	original_index = reorder[moved];
-	for(i = moved; i < size; ++i) {
-		if(reorder[i] < original_index) {
-			++reorder[i];
+	items = (uint32_t *) malloc(sizeof(uint32_t) * length * 2);
+	stack = (radix_bucket *) malloc(sizeof(radix_bucket) * (length / 2 + 1));
+	if(items == NULL || stack == NULL) {
+		free(items);
+		free(stack);
+		return merge_sort(t, stats, head);
+	}
+	scratch = items + length;
+	
+	for(n = head, i = 0; n != NO_NODE; n = t->nodes[n].next) {
+		items[i++] = n;
+	}
+	
+	radix_sort_items(t, stats, items, scratch, stack, length);
+	
+	for(i = 0; i + 1 < length; ++i) {
+		t->nodes[items[i]].next = items[i + 1];
+	}
+	t->nodes[items[length - 1]].next = NO_NODE;
+	head = items[0];
+	
+	free(stack);
+	free(items);
+	return head;
+}
+
+/** Placement **/
+
+/*
+ * For lists that were in order until a few entries changed. The changed
+ * entries are sorted among themselves; the kept ones are taken to be in
+ * order still and keep their places. Each changed entry then finds its
+ * place among them by binary search, and as they come in order the places
+ * only move forward, so one pass relinks the list: O(k log n) comparisons
+ * for k changed entries in a list of n. Entries with the same name keep the
+ * order they were in, as every engine keeps it, so the plan is the same.
+ */
+
+/// Whether kept entry k goes before n: by name, and between equal names by where they were
+static int kept_before(const tree *t, sort_stats *stats, uint32_t k, uint32_t n) {
+	int result = compare_nodes(t, stats, k, n);
+	
+	return result < 0 || (result == 0 && t->nodes[k].index < t->nodes[n].index);
+}
+
+/// Place changed, a list in original order, among kept, which must be in order
+static uint32_t place_list(tree *t, sort_stats *stats, const uint32_t *kept, uint32_t num_kept, uint32_t changed) {
+	node *nodes = t->nodes;
+	uint32_t n, next, list = NO_NODE, *tail = &list;
+	uint32_t i = 0, lo, hi, mid;
+	
+	changed = merge_sort(t, stats, changed);
+	
+	for(n = changed; n != NO_NODE; n = next) {
+		next = nodes[n].next;
+		
+		// the first kept entry that sorts after n, from where the last one went
+		lo = i;
+		hi = num_kept;
+		while(lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if(kept_before(t, stats, kept[mid], n)) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		
+		for(; i < lo; ++i) {
+			*tail = kept[i];
+			tail = &nodes[kept[i]].next;
 		}
+		*tail = n;
+		tail = &nodes[n].next;
+	}
+	for(; i < num_kept; ++i) {
+		*tail = kept[i];
+		tail = &nodes[kept[i]].next;
 	}
+	*tail = NO_NODE;
 	
+	return list;
 }
 
-/** Playlist item operations **/
+static uint32_t *alloc_kept(tree *t, uint32_t head) {
+	uint32_t n, length = 0;
+	
+	for(n = head; n != NO_NODE; n = t->nodes[n].next) {
+		++length;
+	}
+	return (uint32_t *) malloc(sizeof(uint32_t) * (length > 0 ? length : 1));
+}
 
-static playlist_item *create_playlist_item(int index, const char *name) {
-	playlist_item *new_playlist_item = (playlist_item *) malloc(sizeof(playlist_item));
-	if (NULL != new_playlist_item){
-		new_playlist_item->index = index;
-		new_playlist_item->end_index = -1;
-		new_playlist_item->name = strdup(name);
+/// Place the entries marked NODE_CHANGED among the rest, using kept, which has room for the list
+static uint32_t place_marked(tree *t, sort_stats *stats, uint32_t head, uint32_t *kept) {
+	node *nodes = t->nodes;
+	uint32_t n, next, changed = NO_NODE, *changed_tail = &changed;
+	uint32_t num_kept = 0;
+	
+	for(n = head; n != NO_NODE; n = next) {
+		next = nodes[n].next;
+		if(nodes[n].flags & NODE_CHANGED) {
+			*changed_tail = n;
+			changed_tail = &nodes[n].next;
+		} else {
+			kept[num_kept++] = n;
+		}
 	}
-	return new_playlist_item;
+	*changed_tail = NO_NODE;
+	
+	return place_list(t, stats, kept, num_kept, changed);
 }
 
+/// Places the entries marked NODE_CHANGED, as in daemon mode.
+static uint32_t place_changed(tree *t, sort_stats *stats, uint32_t head) {
+	uint32_t *kept;
+	
+	kept = alloc_kept(t, head);
+	if(kept == NULL) {
+		return natural_merge_sort(t, stats, head);
+	}
+	
+	head = place_marked(t, stats, head, kept);
+	free(kept);
+	return head;
+}
+
+/*
+ * The insert engine finds the entries out of place itself, in one pass
+ * that keeps a run in order. An entry that sorts before the last one kept
+ * is set aside, unless it and the entry after it are in order and both
+ * sort before every kept entry they conflict with: then those kept entries
+ * are the odd ones out, as when a playlist far down the list was renamed
+ * to the top, and they are set aside instead. A few entries added to or
+ * renamed in a sorted list cost about n comparisons to find and k log n to
+ * place; a list in no particular order still comes out sorted, only with
+ * more set aside. Entries set aside are marked NODE_CHANGED until placed,
+ * which keeps them in their original order.
+ */
 
-#ifdef TESTING
-static void move_playlist(playlist_item *faux_playlist, int size, int from_index, int to_index) {
+static uint32_t insertion_place(tree *t, sort_stats *stats, uint32_t head) {
+	node *nodes = t->nodes;
+	uint32_t *kept, n, next;
+	uint32_t num_kept = 0, i, lo, hi, mid;
+	
+	kept = alloc_kept(t, head);
+	if(kept == NULL) {
+		return natural_merge_sort(t, stats, head);
+	}
+	
+	for(n = head; n != NO_NODE; n = next) {
+		next = nodes[n].next;
+		if(num_kept > 0 && compare_nodes(t, stats, kept[num_kept - 1], n) > 0) {
+			lo = num_kept;
+			if(next != NO_NODE && compare_nodes(t, stats, n, next) <= 0) {
+				// the first kept entry that sorts after n
+				lo = 0;
+				hi = num_kept - 1;
+				while(lo < hi) {
+					mid = lo + (hi - lo) / 2;
+					if(compare_nodes(t, stats, kept[mid], n) <= 0) {
+						lo = mid + 1;
+					} else {
+						hi = mid;
+					}
+				}
+				if(compare_nodes(t, stats, kept[lo], next) <= 0) {
+					lo = num_kept;
+				}
+			}
+			if(lo == num_kept) {
+				nodes[n].flags |= NODE_CHANGED;
+				continue;
+			}
+			for(i = lo; i < num_kept; ++i) {
+				nodes[kept[i]].flags |= NODE_CHANGED;
+			}
+			num_kept = lo;
+		}
+		kept[num_kept++] = n;
+	}
+	
+	head = place_marked(t, stats, head, kept);
+	free(kept);
+	
+	for(n = head; n != NO_NODE; n = nodes[n].next) {
+		nodes[n].flags &= ~NODE_CHANGED;
+	}
+	return head;
+}
+
+/** Sorting the tree **/
+
+/*
+ * Folders are independent of each other, so with more than one thread each
+ * folder whose subtree spans at least PARALLEL_SORT_CUTOFF entries becomes a
+ * task in a work-stealing pool; smaller folders are sorted inline by
+ * whichever thread reaches them. Every folder is sorted the same way either
+ * way, so the plan does not depend on the number of threads.
+ */
+
+#define PARALLEL_SORT_CUTOFF 4096
+
+typedef uint32_t (*sort_function)(tree *t, sort_stats *stats, uint32_t head);
+
+typedef struct s_tree_sort {
+	tree *t;
+	sort_function sort;
+	sort_stats *stats; // one per thread
+	task_pool *pool;   // NULL when sorting on the calling thread only
+} tree_sort;
+
+static void sort_list(tree_sort *ts, uint32_t parent, int worker) {
+	tree *t = ts->t;
+	uint32_t n;
+	uint64_t started;
+	
+	if(!(t->nodes[parent].flags & NODE_SORTED)) {
+		started = tracing() ? monotonic_ns() : 0;
+		t->nodes[parent].children = ts->sort(t, &ts->stats[worker], t->nodes[parent].children);
+		if(started != 0) {
+			trace_span("sort", parent == ROOT_NODE ? "(top level)" : NODE_NAME(t, parent), started, monotonic_ns());
+		}
+	}
+	
+	for(n = t->nodes[parent].children; n != NO_NODE; n = t->nodes[n].next) {
+		if(t->nodes[n].children == NO_NODE || (t->nodes[n].flags & NODE_SUBTREE_SORTED)) {
+			continue;
+		}
+		if(ts->pool != NULL && t->nodes[n].end_index - t->nodes[n].index >= PARALLEL_SORT_CUTOFF) {
+			task_pool_push(ts->pool, worker, n);
+		} else {
+			sort_list(ts, n, worker);
+		}
+	}
+}
+
+static void sort_folder_task(void *context, uint32_t folder, int worker) {
+	sort_list((tree_sort *) context, folder, worker);
+}
+
+static int sort_tree(tree *t, sort_function sort, int num_threads, sort_stats *total) {
+	tree_sort ts;
 	int i;
-	playlist_item item;
 	
-	item.name = faux_playlist[from_index].name;
-	item.index = faux_playlist[from_index].index;
-	item.end_index = faux_playlist[from_index].end_index;
+	ts.t = t;
+	ts.sort = sort;
+	ts.pool = NULL;
+	ts.stats = (sort_stats *) calloc(num_threads > 1 ? num_threads : 1, sizeof(sort_stats));
+	if(ts.stats == NULL) {
+		return 0;
+	}
+	
+	if(num_threads > 1) {
+		ts.pool = create_task_pool(num_threads, sort_folder_task, &ts);
+	}
+	
+	if(ts.pool == NULL || !task_pool_run(ts.pool, ROOT_NODE)) {
+		if(ts.pool != NULL) {
+			free_task_pool(ts.pool);
+			ts.pool = NULL;
+		}
+		num_threads = 1;
+		sort_list(&ts, ROOT_NODE, 0);
+	}
+	
+	total->comparisons = 0;
+	total->prefix_comparisons = 0;
+	for(i = 0; i < num_threads; ++i) {
+		total->comparisons += ts.stats[i].comparisons;
+		total->prefix_comparisons += ts.stats[i].prefix_comparisons;
+	}
+	
+	if(ts.pool != NULL) {
+		free_task_pool(ts.pool);
+	}
+	free(ts.stats);
+	return 1;
+}
+
+/** Sortedness check **/
+
+typedef struct s_folder_counts {
+	int num_folders; // with at least one child, including the top level
+	int num_sorted;  // of those, already in order
+} folder_counts;
+
+/*
+ * A linear pass before sorting. A folder whose children are already in
+ * order is not sorted again, and a folder whose whole subtree is in order
+ * is neither sorted nor walked when flattening. Returns the number of
+ * container entries below parent, end markers included.
+ */
+static int mark_sorted(tree *t, sort_stats *stats, uint32_t parent, folder_counts *counts) {
+	node *p = &t->nodes[parent];
+	uint32_t n, previous = NO_NODE;
+	int entries = 0, subtree_sorted = 1;
 	
-	if(from_index < to_index) {
-		// shift each item between from_index + 1 and to_index down one
-		for(i = from_index + 1; i <= to_index; ++i) {
-			faux_playlist[i-1].name = faux_playlist[i].name;
-			faux_playlist[i-1].index = faux_playlist[i].index;
-			faux_playlist[i-1].end_index = faux_playlist[i].end_index;
+	p->flags |= NODE_SORTED;
+	
+	for(n = p->children; n != NO_NODE; previous = n, n = t->nodes[n].next) {
+		++entries;
+		
+		if(t->nodes[n].end_index >= 0) {
+			entries += mark_sorted(t, stats, n, counts) + 1;
+			if(!(t->nodes[n].flags & NODE_SUBTREE_SORTED)) {
+				subtree_sorted = 0;
+			}
 		}
-	} else if(from_index > to_index) {
-		// shift each item between from_index - 1 and to_index up one
-		for(i = from_index - 1; i >= to_index; --i) {
-			faux_playlist[i+1].name = faux_playlist[i].name;
-			faux_playlist[i+1].index = faux_playlist[i].index;
-			faux_playlist[i+1].end_index = faux_playlist[i].end_index;
+		
+		if(previous != NO_NODE && (p->flags & NODE_SORTED) && compare_nodes(t, stats, previous, n) > 0) {
+			p->flags &= ~NODE_SORTED;
 		}
 	}
 	
-	faux_playlist[to_index].name = item.name;
-	faux_playlist[to_index].index = item.index;
-	faux_playlist[to_index].end_index = item.end_index;
+	if((p->flags & NODE_SORTED) && subtree_sorted) {
+		p->flags |= NODE_SUBTREE_SORTED;
+	}
+	if(parent != ROOT_NODE && entries == p->end_index - p->index - 1) {
+		p->flags |= NODE_CONTIGUOUS;
+	}
+	
+	if(p->children != NO_NODE) {
+		++counts->num_folders;
+		if(p->flags & NODE_SORTED) {
+			++counts->num_sorted;
+		}
+	}
 	
+	return entries;
 }
-#endif
 
-/**
- * Move playlists
+/*
+ * The same flags and counts as mark_sorted() without comparing any names:
+ * a folder counts as sorted unless one of its children has changed.
  */
-int sort_playlists(sp_session *session)
-{
-	sp_playlistcontainer *pc = sp_session_playlistcontainer(session);
-	sp_playlist_type playlist_type;
-	int i, not_loaded = 0, num_playlists = 0;
-	int *reorder;
-	sp_playlist *pl;
-	node *items, *parent, *previous;
+static int mark_changed(tree *t, uint32_t parent, folder_counts *counts) {
+	node *p = &t->nodes[parent];
+	uint32_t n;
+	int entries = 0, subtree_sorted = 1;
 	
+	p->flags |= NODE_SORTED;
 	
-#ifdef TESTING
-	playlist_item *faux_playlist;
-#endif
+	for(n = p->children; n != NO_NODE; n = t->nodes[n].next) {
+		++entries;
+		
+		if(t->nodes[n].end_index >= 0) {
+			entries += mark_changed(t, n, counts) + 1;
+			if(!(t->nodes[n].flags & NODE_SUBTREE_SORTED)) {
+				subtree_sorted = 0;
+			}
+		}
+		
+		if(t->nodes[n].flags & NODE_CHANGED) {
+			p->flags &= ~NODE_SORTED;
+		}
+	}
 	
-	num_playlists = sp_playlistcontainer_num_playlists(pc);
-	items = previous = parent = NULL;
+	if((p->flags & NODE_SORTED) && subtree_sorted) {
+		p->flags |= NODE_SUBTREE_SORTED;
+	}
+	if(parent != ROOT_NODE && entries == p->end_index - p->index - 1) {
+		p->flags |= NODE_CONTIGUOUS;
+	}
+	
+	if(p->children != NO_NODE) {
+		++counts->num_folders;
+		if(p->flags & NODE_SORTED) {
+			++counts->num_sorted;
+		}
+	}
+	
+	return entries;
+}
+
+/** Flatten for reordering **/
+
+static int _flatten_list(const tree *t, uint32_t head, int *reorder, int idx) {
+	const node *n;
+	int i;
+	
+	for(; head != NO_NODE; head = n->next) {
+		n = &t->nodes[head];
+		
+		if((n->flags & (NODE_SUBTREE_SORTED | NODE_CONTIGUOUS)) == (NODE_SUBTREE_SORTED | NODE_CONTIGUOUS)) {
+			// the folder stays as it is, entries and all
+			for(i = n->index; i <= n->end_index; ++i) {
+				reorder[idx++] = i;
+			}
+			continue;
+		}
+		
+		reorder[idx++] = n->index;
+		
+		if(n->children != NO_NODE) {
+			idx = _flatten_list(t, n->children, reorder, idx);
+		}
+		if(n->end_index >= 0) {
+			reorder[idx++] = n->end_index;
+		}
+	}
 	
-#ifdef TESTING
-	faux_playlist = (playlist_item*) malloc(sizeof(playlist_item) * num_playlists);
-#endif
+	return idx;
+}
+
+static int flatten_list(const tree *t, int *reorder) {
+	return _flatten_list(t, t->nodes[ROOT_NODE].children, reorder, 0);
+}
+
+/** Move planning **/
 
-	printf("Reordering %d playlists and playlist folders\n", num_playlists);
+/*
+ * Mark the entries of reorder (original indexes in sorted order) that form a
+ * longest increasing subsequence. Those entries are already in the right
+ * relative order, so they never have to move; every other entry is moved
+ * once. Returns the length of the subsequence, or -1 if out of memory.
+ */
+static int mark_fixed(const int *reorder, int size, char *fixed) {
+	int *tails, *previous;
+	int i, lo, hi, mid, length = 0;
+	
+	tails = (int *) malloc(sizeof(int) * (size > 0 ? size : 1));
+	previous = (int *) malloc(sizeof(int) * (size > 0 ? size : 1));
+	if(tails == NULL || previous == NULL) {
+		free(previous);
+		free(tails);
+		return -1;
+	}
+	
+	for(i = 0; i < size; ++i) {
+		// find the shortest subsequence whose tail is not smaller than this entry
+		lo = 0;
+		hi = length;
+		while(lo < hi) {
+			mid = (lo + hi) / 2;
+			if(reorder[tails[mid]] < reorder[i]) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		
+		previous[i] = lo > 0 ? tails[lo - 1] : -1;
+		tails[lo] = i;
+		if(lo == length) {
+			++length;
+		}
+		fixed[i] = 0;
+	}
+	
+	for(i = length > 0 ? tails[length - 1] : -1; i >= 0; i = previous[i]) {
+		fixed[i] = 1;
+	}
+	
+	free(previous);
+	free(tails);
+	
+	return length;
+}
+
+/*
+ * Number of moves the old slot-by-slot approach would make: an entry is
+ * already in place when every entry that was originally before it has been
+ * placed, i.e. when it is smaller than everything still to come.
+ */
+static int count_slot_moves(const int *reorder, int size) {
+	int i, smallest = -1, moves = 0;
+	
+	for(i = size - 1; i >= 0; --i) {
+		if(smallest >= 0 && reorder[i] > smallest) {
+			++moves;
+		} else {
+			smallest = reorder[i];
+		}
+	}
+	
+	return moves;
+}
+
+/** Dry runs **/
+
+/// The node each original index belongs to: the entry itself or the folder it ends
+static uint32_t *create_index_nodes(const tree *t, int num_playlists) {
+	uint32_t *index_nodes, n;
+	int i;
+	
+	index_nodes = (uint32_t *) malloc(sizeof(uint32_t) * (num_playlists > 0 ? num_playlists : 1));
+	if(index_nodes == NULL) {
+		return NULL;
+	}
+	for(i = 0; i < num_playlists; ++i) {
+		index_nodes[i] = NO_NODE; // placeholders
+	}
+	for(n = ROOT_NODE + 1; n < t->num_nodes; ++n) {
+		index_nodes[t->nodes[n].index] = n;
+		if(t->nodes[n].end_index >= 0) {
+			index_nodes[t->nodes[n].end_index] = n;
+		}
+	}
+	
+	return index_nodes;
+}
+
+/// Whether the simulated container holds the sorted order, placeholders aside
+static int check_dry_run(const int *order, int num_playlists, const uint32_t *index_nodes, const int *reorder, int size) {
+	int i, j = 0;
+	
+	for(i = 0; i < num_playlists; ++i) {
+		if(index_nodes[order[i]] == NO_NODE) {
+			continue;
+		}
+		if(j == size || order[i] != reorder[j]) {
+			return 0;
+		}
+		j++;
+	}
 	
-	for (i = 0; i < num_playlists; ++i) {
+	return j == size;
+}
+
+static void print_dry_run(const tree *t, const int *order, int num_playlists, const uint32_t *index_nodes) {
+	const node *n;
+	int i, depth = 0;
+	
+	for(i = 0; i < num_playlists; ++i) {
+		if(index_nodes[order[i]] == NO_NODE) {
+			printf("%*s(placeholder)\n", depth * 2, "");
+			continue;
+		}
+		
+		n = &t->nodes[index_nodes[order[i]]];
+		if(n->end_index == order[i]) {
+			depth--;
+		} else {
+			printf("%*s%.*s%s\n", depth * 2, "", (int) n->name_length, NODE_NAME(t, index_nodes[order[i]]),
+				   n->end_index >= 0 ? "/" : "");
+			if(n->end_index >= 0) {
+				depth++;
+			}
+		}
+	}
+}
+
+/** Reporting **/
+
+const char *sort_phase_names[NUM_SORT_PHASES] = {
+	"build",
+	"sort",
+	"flatten",
+	"plan",
+	"apply"
+};
+
+static void inform(const sort_options *options, const char *format, ...) {
+	va_list args;
+	
+	if(options->quiet) {
+		return;
+	}
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+}
+
+static void end_phase(sort_report *report, sort_phase phase, stopwatch *watch) {
+	uint64_t started = watch->wall_ns;
+	
+	stop_phase(watch, report != NULL ? &report->phases[phase] : NULL);
+	trace_span("phase", sort_phase_names[phase], started, watch->wall_ns);
+}
+
+/** Sorting playlists **/
+
+struct s_sort_plan {
+	sp_playlistcontainer *pc;
+	sort_options options;
+	sort_report *report;   // NULL if nobody asked
+	stopwatch watch;
+	
+	tree items;
+	int num_playlists;
+	int *reorder;          // original indexes in sorted order; NULL if nothing moves
+	int size;
+	char *fixed;           // entries of reorder that stay where they are
+	int *slot;             // virtual slot of each original index
+	int *target;           // virtual slot each entry of reorder goes to
+	int *occupied;         // position tree over the slots
+	int num_slots;
+	sim_container *sim;    // stands in for the container in dry runs
+	sp_playlist **changed; // by address; NULL to sort everything
+	const uint8_t *changed_entries; // or by container index, while building the tree
+	int num_changed;
+	
+	int next;              // entry of reorder to place next
+	int num_planned;
+	int num_placed;        // of the planned moves
+	int num_moves;         // sent, leaving out moves that turned out to be no-ops
+	int finished;
+	progress moves;
+};
+
+void free_sort_plan(sort_plan *plan) {
+	if(plan == NULL) {
+		return;
+	}
+	free_sim_container(plan->sim);
+	free(plan->occupied);
+	free(plan->target);
+	free(plan->slot);
+	free(plan->fixed);
+	free(plan->reorder);
+	free(plan->changed);
+	free_tree(&plan->items);
+	free(plan);
+}
+
+static int compare_playlists(const void *a, const void *b) {
+	const sp_playlist *x = *(sp_playlist * const *) a, *y = *(sp_playlist * const *) b;
+	
+	return x < y ? -1 : x > y;
+}
+
+/// Read the container into plan->items; 0 if it cannot be sorted
+static int build_tree(sort_plan *plan) {
+	sp_playlistcontainer *pc = plan->pc;
+	tree *items = &plan->items;
+	sp_playlist_type playlist_type;
+	sp_playlist *pl;
+	uint32_t parent = ROOT_NODE, previous = NO_NODE;
+	int i, not_loaded = 0;
+	
+	for (i = 0; i < plan->num_playlists; ++i) {
 		playlist_type = sp_playlistcontainer_playlist_type(pc, i);
 		
 		switch (playlist_type) {
@@ -279,101 +1484,340 @@ int sort_playlists(sp_session *session)
 				if (!sp_playlist_is_loaded(pl)) {
 					not_loaded++;
 				} else {
-					previous = create_node(previous, parent, create_playlist_item(i, sp_playlist_name(pl)));
-					if (items == NULL) {
-						items = previous;
+					previous = create_node(items, previous, parent, i, sp_playlist_name(pl));
+					if (previous == NO_NODE) {
+						printf("ERROR: out of memory\n");
+						return 0;
+					}
+					if ((plan->changed != NULL && bsearch(&pl, plan->changed, plan->num_changed, sizeof(sp_playlist *), compare_playlists) != NULL)
+							|| (plan->changed_entries != NULL && plan->changed_entries[i])) {
+						items->nodes[previous].flags |= NODE_CHANGED;
 					}
 				}
 				
-#ifdef TESTING
-				faux_playlist[i].index = -1;
-				faux_playlist[i].name = strdup(sp_playlist_name(pl));
-#endif
-				
 				break;
 			case SP_PLAYLIST_TYPE_START_FOLDER:
 				
-				parent = create_node(previous, parent, create_playlist_item(i, sp_playlistcontainer_playlist_folder_name(pc, i)));
-				previous = NULL;
-				if (items == NULL) {
-					items = parent;
+				parent = create_node(items, previous, parent, i, sp_playlistcontainer_playlist_folder_name(pc, i));
+				if (parent == NO_NODE) {
+					printf("ERROR: out of memory\n");
+					return 0;
 				}
-				
-#ifdef TESTING
-				faux_playlist[i].index = sp_playlistcontainer_playlist_folder_id(pc, i);
-				faux_playlist[i].name = strdup(sp_playlistcontainer_playlist_folder_name(pc, i));
-#endif
+				if (plan->changed_entries != NULL && plan->changed_entries[i]) {
+					items->nodes[parent].flags |= NODE_CHANGED;
+				}
+				previous = NO_NODE;
 				
 				break;
 			case SP_PLAYLIST_TYPE_END_FOLDER:
 				
 				previous = parent;
-				previous->item->end_index = i;
-				parent = parent->parent;
-				
-#ifdef TESTING
-				faux_playlist[i].index = sp_playlistcontainer_playlist_folder_id(pc, i);
-				faux_playlist[i].name = NULL;
-#endif
+				items->nodes[previous].end_index = i;
+				parent = items->nodes[parent].parent;
 				
 				break;
 			case SP_PLAYLIST_TYPE_PLACEHOLDER:
-
-#ifdef TESTING
-				printf("%d. Placeholder", i);
-				faux_playlist[i].index = -1;
-				faux_playlist[i].name = NULL;
-#endif
-				
 				break;
 		}
 	}
 	
 	if(not_loaded > 0) {
 		printf("ERROR: %d playlists could not be loaded\n", not_loaded);
-		return 1;
+		return 0;
 	}
 	
-	if(items != NULL) {
-		items = sort_list(items);
+	return 1;
+}
 
-#ifdef TESTING
-		print_list(items);
-#endif
+/// Plan a sort, or with changed or changed_entries a placement of just those entries
+static sort_plan *make_plan(sp_session *session, const sort_options *options, sp_playlist *const *changed, const uint8_t *changed_entries, int num_changed, sort_report *report) {
+	sort_plan *plan;
+	sort_stats stats, check_stats;
+	folder_counts folders;
+	sort_function sort;
+	int num_fixed, slot_moves, placing = changed != NULL || changed_entries != NULL;
+	
+	if(report != NULL) {
+		memset(report, 0, sizeof(sort_report));
+	}
+	
+	plan = (sort_plan *) calloc(1, sizeof(sort_plan));
+	if(plan == NULL) {
+		printf("ERROR: out of memory\n");
+		return NULL;
+	}
+	start_stopwatch(&plan->watch);
+	plan->pc = sp_session_playlistcontainer(session);
+	plan->options = *options;
+	plan->report = report;
+	
+	if(changed != NULL) {
+		plan->changed = (sp_playlist **) malloc(sizeof(sp_playlist *) * (num_changed > 0 ? num_changed : 1));
+		if(plan->changed == NULL) {
+			printf("ERROR: out of memory\n");
+			free(plan);
+			return NULL;
+		}
+		memcpy(plan->changed, changed, sizeof(sp_playlist *) * num_changed);
+		qsort(plan->changed, num_changed, sizeof(sp_playlist *), compare_playlists);
+		plan->num_changed = num_changed;
+	}
+	plan->changed_entries = changed_entries;
+	
+	plan->num_playlists = sp_playlistcontainer_num_playlists(plan->pc);
+	if(!create_tree(&plan->items, plan->num_playlists, 1)) {
+		printf("ERROR: could not allocate %d playlists\n", plan->num_playlists);
+		free(plan->changed);
+		free(plan);
+		return NULL;
+	}
+	
+	if(placing) {
+		inform(options, "Placing %d changed playlists among %d playlists and playlist folders\n", num_changed, plan->num_playlists);
+	} else {
+		inform(options, "Reordering %d playlists and playlist folders\n", plan->num_playlists);
+	}
+	
+	if(!build_tree(plan)) {
+		free_sort_plan(plan);
+		return NULL;
+	}
+	plan->changed_entries = NULL;
+	end_phase(report, SORT_PHASE_BUILD, &plan->watch);
+	
+	memset(&check_stats, 0, sizeof(check_stats));
+	memset(&folders, 0, sizeof(folders));
+	if(placing) {
+		mark_changed(&plan->items, ROOT_NODE, &folders);
+	} else {
+		mark_sorted(&plan->items, &check_stats, ROOT_NODE, &folders);
+	}
+	
+	if(plan->items.nodes[ROOT_NODE].flags & NODE_SUBTREE_SORTED) {
+		inform(options, "All %d folders are already sorted\n", folders.num_folders);
+		end_phase(report, SORT_PHASE_SORT, &plan->watch);
+		end_phase(report, SORT_PHASE_FLATTEN, &plan->watch);
+		end_phase(report, SORT_PHASE_PLAN, &plan->watch);
+		stats = check_stats;
+	} else {
+		switch(options->engine) {
+			case SORT_ENGINE_MERGE:
+				sort = merge_sort;
+				break;
+			case SORT_ENGINE_RADIX:
+				sort = radix_sort;
+				break;
+			case SORT_ENGINE_INSERT:
+				sort = insertion_place;
+				break;
+			default:
+				sort = natural_merge_sort;
+				break;
+		}
+		if(placing) {
+			sort = place_changed;
+		}
 		
-		reorder = (int *) malloc(sizeof(int) * num_playlists);
-		flatten_list(items, reorder);
+		if(!sort_tree(&plan->items, sort, options->threads, &stats)) {
+			printf("ERROR: out of memory\n");
+			free_sort_plan(plan);
+			return NULL;
+		}
+		end_phase(report, SORT_PHASE_SORT, &plan->watch);
+		stats.comparisons += check_stats.comparisons;
+		stats.prefix_comparisons += check_stats.prefix_comparisons;
 		
-		for(i = 0; i < num_playlists; ++i) {
-			printf(".");
-			if(i != reorder[i]) {
-#ifdef TESTING
-				printf("Moving item at %d -> %d\n", reorder[i], i);
-				move_playlist(faux_playlist, num_playlists, reorder[i], i);
-#else			
-				sp_playlistcontainer_move_playlist(pc, reorder[i], i);
-#endif
-				recalculate_indexes(reorder, num_playlists, i);
-			}
+		inform(options, "Skipped %d of %d folders that were already sorted\n", folders.num_sorted, folders.num_folders);
+		inform(options, "Sorted with %llu comparisons, %llu decided by the name prefix\n",
+			   (unsigned long long) stats.comparisons, (unsigned long long) stats.prefix_comparisons);
+		
+		plan->reorder = (int *) malloc(sizeof(int) * (plan->num_playlists > 0 ? plan->num_playlists : 1));
+		if(plan->reorder == NULL) {
+			printf("ERROR: out of memory\n");
+			free_sort_plan(plan);
+			return NULL;
+		}
+		plan->size = flatten_list(&plan->items, plan->reorder);
+		end_phase(report, SORT_PHASE_FLATTEN, &plan->watch);
+		
+		plan->fixed = (char *) malloc(sizeof(char) * (plan->size > 0 ? plan->size : 1));
+		plan->slot = (int *) malloc(sizeof(int) * (plan->num_playlists > 0 ? plan->num_playlists : 1));
+		plan->target = (int *) malloc(sizeof(int) * (plan->size > 0 ? plan->size : 1));
+		if(plan->fixed == NULL || plan->slot == NULL || plan->target == NULL) {
+			printf("ERROR: out of memory\n");
+			free_sort_plan(plan);
+			return NULL;
+		}
+		
+		num_fixed = mark_fixed(plan->reorder, plan->size, plan->fixed);
+		if(num_fixed < 0) {
+			printf("ERROR: out of memory\n");
+			free_sort_plan(plan);
+			return NULL;
+		}
+		plan->num_planned = plan->size - num_fixed;
+		slot_moves = count_slot_moves(plan->reorder, plan->size);
+		
+		inform(options, "Planned %d moves (%d fewer than moving slot by slot)\n", plan->num_planned, slot_moves - plan->num_planned);
+		
+		plan->num_slots = layout_slots(plan->reorder, plan->fixed, plan->size, plan->num_playlists, plan->slot, plan->target);
+		if(plan->num_slots >= 0) {
+			plan->occupied = create_position_tree(plan->slot, plan->num_playlists, plan->num_slots);
 		}
-		printf("\ndone\n");
+		if(options->dry_run) {
+			plan->sim = create_sim_container(plan->num_playlists);
+		}
+		if(plan->occupied == NULL || (options->dry_run && plan->sim == NULL)) {
+			printf("ERROR: out of memory\n");
+			free_sort_plan(plan);
+			return NULL;
+		}
+		end_phase(report, SORT_PHASE_PLAN, &plan->watch);
 		
-		free(reorder);
-		free_list(items);
+		start_progress(&plan->moves, stdout, "moves", plan->num_planned, options->quiet ? 0 : options->progress_rate);
 	}
 	
+	if(report != NULL) {
+		report->num_entries = plan->num_playlists;
+		report->num_folders = folders.num_folders;
+		report->num_sorted_folders = folders.num_sorted;
+		report->comparisons = stats.comparisons;
+		report->prefix_comparisons = stats.prefix_comparisons;
+	}
 	
-#ifdef TESTING
-	for(i = 0; i < num_playlists; ++i) {
-		if(faux_playlist[i].name != NULL) {
-			printf(" -- %s (%d)\n", faux_playlist[i].name, faux_playlist[i].index);
-			free((void*)faux_playlist[i].name);
-		} else {
-			printf(" -- %d\n", faux_playlist[i].index);
+	return plan;
+}
+
+/// Check and print the simulated container; 0 if the moves did not sort it
+static int finish_dry_run(sort_plan *plan) {
+	uint32_t *index_nodes;
+	int *order, checked = 1;
+	
+	order = (int *) malloc(sizeof(int) * (plan->num_playlists > 0 ? plan->num_playlists : 1));
+	index_nodes = create_index_nodes(&plan->items, plan->num_playlists);
+	
+	if(order == NULL || index_nodes == NULL || !sim_container_list(plan->sim, order)) {
+		printf("ERROR: out of memory\n");
+		checked = 0;
+	} else if(!check_dry_run(order, plan->num_playlists, index_nodes, plan->reorder, plan->size)) {
+		printf("ERROR: the planned moves do not give the sorted order\n");
+		checked = 0;
+	} else if(!plan->options.quiet) {
+		printf("Dry run, nothing was moved. The container would be:\n");
+		print_dry_run(&plan->items, order, plan->num_playlists, index_nodes);
+	}
+	
+	free(index_nodes);
+	free(order);
+	return checked;
+}
+
+sort_plan *plan_sort(sp_session *session, const sort_options *options, sort_report *report) {
+	return make_plan(session, options, NULL, NULL, 0, report);
+}
+
+sort_plan *plan_placement(sp_session *session, const sort_options *options, sp_playlist *const *changed, int num_changed, sort_report *report) {
+	return make_plan(session, options, changed, NULL, num_changed, report);
+}
+
+sort_plan *plan_changed_entries(sp_session *session, const sort_options *options, const uint8_t *changed, int num_changed, sort_report *report) {
+	return make_plan(session, options, NULL, changed, num_changed, report);
+}
+
+int apply_sort_plan(sort_plan *plan, int max_moves) {
+	int i, from, to, sent = 0;
+	uint64_t moved;
+	
+	// place each moved entry directly after its sorted predecessor
+	while(plan->next < plan->size && sent < max_moves) {
+		i = plan->next++;
+		if(plan->fixed[i]) {
+			continue;
+		}
+		
+		from = fenwick_count(plan->occupied, plan->slot[plan->reorder[i]]);
+		fenwick_add(plan->occupied, plan->num_slots, plan->slot[plan->reorder[i]], -1);
+		to = fenwick_count(plan->occupied, plan->target[i]);
+		fenwick_add(plan->occupied, plan->num_slots, plan->target[i], 1);
+		plan->slot[plan->reorder[i]] = plan->target[i];
+		plan->num_placed++;
+		step_progress(&plan->moves);
+		
+		if(from != to) {
+			sent++;
+			if(plan->sim != NULL) {
+				sim_container_move(plan->sim, from, to);
+			} else {
+				moved = tracing() ? monotonic_ns() : 0;
+				// libspotify counts the new position from before the entry is removed
+				sp_playlistcontainer_move_playlist(plan->pc, from, from < to ? to + 1 : to);
+				if(moved != 0) {
+					trace_span("move", "sp_playlistcontainer_move_playlist", moved, monotonic_ns());
+				}
+			}
 		}
 	}
-	free(faux_playlist);
-#endif
+	plan->num_moves += sent;
 	
-	return 1;
+	if(plan->next < plan->size) {
+		return plan->num_planned - plan->num_placed;
+	}
+	if(plan->finished) {
+		return 0;
+	}
+	plan->finished = 1;
+	
+	if(plan->reorder != NULL && !plan->options.quiet) {
+		finish_progress(&plan->moves);
+	}
+	end_phase(plan->report, SORT_PHASE_APPLY, &plan->watch);
+	if(plan->report != NULL) {
+		plan->report->num_moves = plan->num_moves;
+	}
+	
+	if(plan->sim != NULL && !finish_dry_run(plan)) {
+		return -1;
+	}
+	return 0;
+}
+
+int sort_plan_moves_sent(const sort_plan *plan) {
+	return plan->num_moves;
+}
+
+int playlists_sorted(sp_playlistcontainer *pc) {
+	sort_plan plan;
+	sort_stats stats;
+	folder_counts folders;
+	int sorted = 0;
+	
+	memset(&plan, 0, sizeof(plan));
+	plan.pc = pc;
+	plan.num_playlists = sp_playlistcontainer_num_playlists(pc);
+	if(!create_tree(&plan.items, plan.num_playlists, 1)) {
+		return 0;
+	}
+	
+	if(build_tree(&plan)) {
+		memset(&stats, 0, sizeof(stats));
+		memset(&folders, 0, sizeof(folders));
+		mark_sorted(&plan.items, &stats, ROOT_NODE, &folders);
+		sorted = (plan.items.nodes[ROOT_NODE].flags & NODE_SUBTREE_SORTED) != 0;
+	}
+	
+	free_tree(&plan.items);
+	return sorted;
+}
+
+int sort_playlists(sp_session *session, const sort_options *options, sort_report *report) {
+	sort_plan *plan = plan_sort(session, options, report);
+	int remaining;
+	
+	if(plan == NULL) {
+		return 0;
+	}
+	remaining = apply_sort_plan(plan, INT_MAX);
+	free_sort_plan(plan);
+	
+	return remaining == 0;
 }
@@ -10,6 +10,92 @@
 #ifndef PLAYLIST_H_
 #define PLAYLIST_H_
 
-extern int sort_playlists(sp_session *session);
+#include <stdint.h>
+
+#include "timing.h"
+
+typedef enum {
+	SORT_ENGINE_NATURAL,
+	SORT_ENGINE_MERGE,
+	SORT_ENGINE_RADIX,
+	SORT_ENGINE_INSERT // binary-search the entries out of place into the rest
+} sort_engine;
+
+typedef struct s_sort_options {
+	sort_engine engine;
+	int threads; // for sorting folders in parallel; 1 sorts on the calling thread
+	int quiet;   // print errors only
+	int dry_run; // move entries in a copy of the container and print it instead
+	int progress_rate; // redraws of the progress line per second on a terminal
+} sort_options;
+
+typedef enum {
+	SORT_PHASE_BUILD,   // reading the container into a tree
+	SORT_PHASE_SORT,    // checking and sorting folders
+	SORT_PHASE_FLATTEN, // listing the sorted order
+	SORT_PHASE_PLAN,    // choosing which entries move
+	SORT_PHASE_APPLY,   // moving them
+	NUM_SORT_PHASES
+} sort_phase;
+
+extern const char *sort_phase_names[NUM_SORT_PHASES];
+
+typedef struct s_sort_report {
+	phase_report phases[NUM_SORT_PHASES];
+	
+	int num_entries;
+	int num_folders;
+	int num_sorted_folders;
+	uint64_t comparisons;
+	uint64_t prefix_comparisons;
+	int num_moves;
+} sort_report;
+
+typedef struct s_sort_plan sort_plan;
+
+/**
+ * Read the session's container and work out the moves that sort it by
+ * name. Returns NULL, having said why, if it cannot be sorted. If report
+ * is not NULL it is filled in as the plan is made and applied.
+ */
+extern sort_plan *plan_sort(sp_session *session, const sort_options *options, sort_report *report);
+
+/**
+ * Like plan_sort(), but only the changed playlists are placed, each by
+ * binary search among its siblings, which are taken to be in order still.
+ * For keeping a sorted container sorted as it changes.
+ */
+extern sort_plan *plan_placement(sp_session *session, const sort_options *options, sp_playlist *const *changed, int num_changed, sort_report *report);
+
+/**
+ * Like plan_placement(), with the entries to place, folders included, given
+ * by container index: those i with changed[i] set, num_changed of them.
+ */
+extern sort_plan *plan_changed_entries(sp_session *session, const sort_options *options, const uint8_t *changed, int num_changed, sort_report *report);
+
+/**
+ * Send up to max_moves of the planned moves. Returns how many are left to
+ * place, 0 once the container is sorted, or -1 if a dry run went wrong.
+ */
+extern int apply_sort_plan(sort_plan *plan, int max_moves);
+
+/// How many moves have been sent so far, leaving out any that were no-ops
+extern int sort_plan_moves_sent(const sort_plan *plan);
+
+extern void free_sort_plan(sort_plan *plan);
+
+/**
+ * Whether the children of every folder, and the top level, are in the
+ * order a sort leaves them in. 0 too if that cannot be told, as when a
+ * playlist has not loaded.
+ */
+extern int playlists_sorted(sp_playlistcontainer *pc);
+
+/**
+ * Plan and apply a sort in one go.
+ * If report is not NULL it is filled in with what the run did.
+ * Returns 0 if the container could not be sorted.
+ */
+extern int sort_playlists(sp_session *session, const sort_options *options, sort_report *report);
 
 #endif
\ No newline at end of file
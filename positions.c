@@ -0,0 +1,88 @@
+/*
+ *  positions.c
+ *  SpotifySort
+ *
+ */
+
+#include <stdlib.h>
+
+#include "positions.h"
+
+/*
+ * Moved entries are tracked in a Fenwick tree over "virtual slots": every
+ * original slot, followed by a gap for each moved entry that will be placed
+ * after it. A slot holds a 1 while an entry occupies it, so the current
+ * position of an entry is the number of occupied slots before its own.
+ */
+
+void fenwick_add(int *counts, int num_slots, int slot, int delta) {
+	for(++slot; slot <= num_slots; slot += slot & -slot) {
+		counts[slot] += delta;
+	}
+}
+
+int fenwick_count(const int *counts, int slot) {
+	int count = 0;
+	
+	for(; slot > 0; slot -= slot & -slot) {
+		count += counts[slot];
+	}
+	
+	return count;
+}
+
+int layout_slots(const int *reorder, const char *fixed, int size, int num_playlists, int *slot, int *target) {
+	int *rank;
+	int i, x, v = 0;
+	
+	// rank[x] is the position of original index x in reorder, -1 if absent
+	rank = (int *) malloc(sizeof(int) * (num_playlists > 0 ? num_playlists : 1));
+	if(rank == NULL) {
+		return -1;
+	}
+	for(x = 0; x < num_playlists; ++x) {
+		rank[x] = -1;
+	}
+	for(i = 0; i < size; ++i) {
+		rank[reorder[i]] = i;
+	}
+	
+	// entries sorted before the first fixed one go to the very front
+	for(i = 0; i < size && !fixed[i]; ++i) {
+		target[i] = v++;
+	}
+	
+	for(x = 0; x < num_playlists; ++x) {
+		slot[x] = v++;
+		if(rank[x] >= 0 && fixed[rank[x]]) {
+			for(i = rank[x] + 1; i < size && !fixed[i]; ++i) {
+				target[i] = v++;
+			}
+		}
+	}
+	
+	free(rank);
+	return v;
+}
+
+int *create_position_tree(const int *slot, int num_playlists, int num_slots) {
+	int *counts = (int *) calloc(num_slots + 1, sizeof(int));
+	int x, parent;
+	
+	if(counts == NULL) {
+		return NULL;
+	}
+	for(x = 0; x < num_playlists; ++x) {
+		counts[slot[x] + 1] = 1;
+	}
+	
+	// build in linear time by pushing each partial sum to its parent
+	for(x = 1; x <= num_slots; ++x) {
+		parent = x + (x & -x);
+		if(parent <= num_slots) {
+			counts[parent] += counts[x];
+		}
+	}
+	
+	return counts;
+}
@@ -0,0 +1,31 @@
+/*
+ *  positions.h
+ *  SpotifySort
+ *
+ *  Tracks where each entry of the container is while a plan of moves is
+ *  applied, in O(log n) per move, without touching the entries between.
+ *
+ */
+
+#ifndef POSITIONS_H_
+#define POSITIONS_H_
+
+/**
+ * Lay out the virtual slots for a plan. reorder holds original indexes in
+ * sorted order and fixed marks the entries of it that stay where they are.
+ * slot[x] is set to the slot of the entry originally at x, target[i] to the
+ * slot reorder[i] is moved to (for entries that are not fixed). Returns the
+ * number of virtual slots, or -1 if out of memory.
+ */
+extern int layout_slots(const int *reorder, const char *fixed, int size, int num_playlists, int *slot, int *target);
+
+/// A position tree with the slots of the original entries occupied; NULL if out of memory
+extern int *create_position_tree(const int *slot, int num_playlists, int num_slots);
+
+/// Occupy (delta 1) or clear (delta -1) a slot
+extern void fenwick_add(int *counts, int num_slots, int slot, int delta);
+
+/// The number of occupied slots before slot, i.e. the position of an entry in it
+extern int fenwick_count(const int *counts, int slot);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ *  progress.c
+ *  SpotifySort
+ *
+ */
+
+#include <unistd.h>
+
+#include "progress.h"
+#include "timing.h"
+
+void start_progress(progress *p, FILE *out, const char *unit, int total, int updates_per_second) {
+	p->out = out;
+	p->unit = unit;
+	p->total = total;
+	p->done = 0;
+	p->live = updates_per_second > 0 && isatty(fileno(out));
+	p->started_ns = monotonic_ns();
+	p->interval_ns = updates_per_second > 0 ? 1000000000ULL / updates_per_second : 0;
+	p->next_draw_ns = p->started_ns + p->interval_ns;
+}
+
+static void draw(progress *p, uint64_t now) {
+	double seconds = (now - p->started_ns) / 1e9;
+	double rate = seconds > 0 ? p->done / seconds : 0;
+	int remaining = p->total - p->done;
+	long eta;
+	
+	fprintf(p->out, "\r%d/%d %s, %d to go", p->done, p->total, p->unit, remaining);
+	if(rate > 0) {
+		eta = (long) (remaining / rate + 0.5);
+		fprintf(p->out, ", %.0f/s, ETA %ld:%02ld", rate, eta / 60, eta % 60);
+	}
+	fprintf(p->out, "\033[K"); // clear what is left of a longer line
+	fflush(p->out);
+}
+
+void step_progress(progress *p) {
+	uint64_t now;
+	
+	p->done++;
+	if(!p->live) {
+		return;
+	}
+	
+	now = monotonic_ns();
+	if(now >= p->next_draw_ns) {
+		draw(p, now);
+		p->next_draw_ns = now + p->interval_ns;
+	}
+}
+
+void finish_progress(progress *p) {
+	uint64_t now = monotonic_ns();
+	
+	if(p->live) {
+		draw(p, now);
+		fprintf(p->out, "\n");
+	} else {
+		fprintf(p->out, "%d %s in %.1f s\n", p->done, p->unit, (now - p->started_ns) / 1e9);
+	}
+}
@@ -0,0 +1,37 @@
+/*
+ *  progress.h
+ *  SpotifySort
+ *
+ *  A progress line for long loops that redraws itself a few times a second
+ *  at most, however often it is told about progress. It stays silent when
+ *  the output is not a terminal, so logs get a summary instead of a flood.
+ *
+ */
+
+#ifndef PROGRESS_H_
+#define PROGRESS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct s_progress {
+	FILE *out;
+	const char *unit;       // what is being counted, e.g. "moves"
+	int total;
+	int done;
+	int live;               // whether the line is drawn at all
+	uint64_t started_ns;
+	uint64_t interval_ns;   // between redraws
+	uint64_t next_draw_ns;
+} progress;
+
+/// Start counting towards total; updates_per_second of 0 never redraws
+extern void start_progress(progress *p, FILE *out, const char *unit, int total, int updates_per_second);
+
+/// Count one more done, redrawing the line if it is due
+extern void step_progress(progress *p);
+
+/// Draw the final state and end the line, or print a summary if the line was never drawn
+extern void finish_progress(progress *p);
+
+#endif
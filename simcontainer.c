@@ -0,0 +1,245 @@
+/*
+ *  simcontainer.c
+ *  SpotifySort
+ *
+ */
+
+#include <stdlib.h>
+
+#include "simcontainer.h"
+
+/*
+ * The container is an implicit treap: a binary tree in container order
+ * that is also a heap on random priorities, so it stays balanced with high
+ * probability. Nodes know the size of their subtree rather than their
+ * position, so a move takes the entry out and puts it back in O(log n)
+ * and never touches the entries in between.
+ */
+
+#define NO_SIM_NODE ((uint32_t) -1)
+
+typedef struct s_sim_node {
+	uint32_t left;
+	uint32_t right;
+	uint32_t priority;
+	uint32_t size; // of the subtree
+} sim_node;
+
+struct s_sim_container {
+	sim_node *nodes; // node i holds entry i
+	uint32_t root;
+	int size;
+};
+
+static uint32_t subtree_size(const sim_container *sim, uint32_t n) {
+	return n == NO_SIM_NODE ? 0 : sim->nodes[n].size;
+}
+
+static void update_size(sim_container *sim, uint32_t n) {
+	sim_node *node = &sim->nodes[n];
+	
+	node->size = 1 + subtree_size(sim, node->left) + subtree_size(sim, node->right);
+}
+
+/// Split n into its first count entries and the rest
+static void split(sim_container *sim, uint32_t n, uint32_t count, uint32_t *first, uint32_t *rest) {
+	if(n == NO_SIM_NODE) {
+		*first = *rest = NO_SIM_NODE;
+	} else if(subtree_size(sim, sim->nodes[n].left) < count) {
+		split(sim, sim->nodes[n].right, count - subtree_size(sim, sim->nodes[n].left) - 1, &sim->nodes[n].right, rest);
+		update_size(sim, n);
+		*first = n;
+	} else {
+		split(sim, sim->nodes[n].left, count, first, &sim->nodes[n].left);
+		update_size(sim, n);
+		*rest = n;
+	}
+}
+
+/// Join two trees, every entry of a coming before every entry of b
+static uint32_t merge(sim_container *sim, uint32_t a, uint32_t b) {
+	if(a == NO_SIM_NODE) {
+		return b;
+	}
+	if(b == NO_SIM_NODE) {
+		return a;
+	}
+	
+	if(sim->nodes[a].priority > sim->nodes[b].priority) {
+		sim->nodes[a].right = merge(sim, sim->nodes[a].right, b);
+		update_size(sim, a);
+		return a;
+	} else {
+		sim->nodes[b].left = merge(sim, a, sim->nodes[b].left);
+		update_size(sim, b);
+		return b;
+	}
+}
+
+/// Take the entry at position index out of the tree
+static uint32_t take(sim_container *sim, uint32_t index) {
+	uint32_t *link = &sim->root, n, left;
+	
+	for(;;) {
+		n = *link;
+		left = subtree_size(sim, sim->nodes[n].left);
+		sim->nodes[n].size--;
+		
+		if(index < left) {
+			link = &sim->nodes[n].left;
+		} else if(index == left) {
+			break;
+		} else {
+			index -= left + 1;
+			link = &sim->nodes[n].right;
+		}
+	}
+	
+	*link = merge(sim, sim->nodes[n].left, sim->nodes[n].right);
+	return n;
+}
+
+/// Put a node taken out with take() back in at position index
+static void put(sim_container *sim, uint32_t n, uint32_t index) {
+	uint32_t *link = &sim->root, m, left;
+	
+	// go down to where the node belongs in the heap, then split what is there around it
+	while(*link != NO_SIM_NODE && sim->nodes[*link].priority > sim->nodes[n].priority) {
+		m = *link;
+		left = subtree_size(sim, sim->nodes[m].left);
+		sim->nodes[m].size++;
+		
+		if(index <= left) {
+			link = &sim->nodes[m].left;
+		} else {
+			index -= left + 1;
+			link = &sim->nodes[m].right;
+		}
+	}
+	
+	split(sim, *link, index, &sim->nodes[n].left, &sim->nodes[n].right);
+	update_size(sim, n);
+	*link = n;
+}
+
+static uint32_t fix_sizes(sim_container *sim, uint32_t n) {
+	if(n != NO_SIM_NODE) {
+		fix_sizes(sim, sim->nodes[n].left);
+		fix_sizes(sim, sim->nodes[n].right);
+		update_size(sim, n);
+	}
+	return n;
+}
+
+sim_container *create_sim_container(int size) {
+	sim_container *sim;
+	uint32_t *spine, i, top = 0, last;
+	uint32_t random = 2463534242U;
+	
+	sim = (sim_container *) malloc(sizeof(sim_container));
+	if(sim == NULL) {
+		return NULL;
+	}
+	sim->nodes = (sim_node *) malloc(sizeof(sim_node) * (size > 0 ? size : 1));
+	spine = (uint32_t *) malloc(sizeof(uint32_t) * (size > 0 ? size : 1));
+	if(sim->nodes == NULL || spine == NULL) {
+		free(spine);
+		free(sim->nodes);
+		free(sim);
+		return NULL;
+	}
+	sim->size = size;
+	
+	// entries arrive in order, so the tree is built along its right spine in O(n)
+	for(i = 0; i < (uint32_t) size; ++i) {
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		
+		sim->nodes[i].left = sim->nodes[i].right = NO_SIM_NODE;
+		sim->nodes[i].priority = random;
+		
+		last = NO_SIM_NODE;
+		while(top > 0 && sim->nodes[spine[top - 1]].priority < random) {
+			last = spine[--top];
+		}
+		sim->nodes[i].left = last;
+		if(top > 0) {
+			sim->nodes[spine[top - 1]].right = i;
+		}
+		spine[top++] = i;
+	}
+	
+	sim->root = top > 0 ? spine[0] : NO_SIM_NODE;
+	free(spine);
+	
+	fix_sizes(sim, sim->root);
+	return sim;
+}
+
+void free_sim_container(sim_container *sim) {
+	if(sim != NULL) {
+		free(sim->nodes);
+		free(sim);
+	}
+}
+
+int sim_container_size(const sim_container *sim) {
+	return sim->size;
+}
+
+int sim_container_entry(const sim_container *sim, int index) {
+	uint32_t n = sim->root, left;
+	
+	if(index < 0 || index >= sim->size) {
+		return -1;
+	}
+	
+	for(;;) {
+		left = subtree_size(sim, sim->nodes[n].left);
+		if((uint32_t) index < left) {
+			n = sim->nodes[n].left;
+		} else if((uint32_t) index == left) {
+			return (int) n;
+		} else {
+			index -= left + 1;
+			n = sim->nodes[n].right;
+		}
+	}
+}
+
+int sim_container_move(sim_container *sim, int from, int to) {
+	if(from < 0 || from >= sim->size || to < 0 || to >= sim->size) {
+		return 0;
+	}
+	if(from == to) {
+		return 1;
+	}
+	
+	put(sim, take(sim, (uint32_t) from), (uint32_t) to);
+	return 1;
+}
+
+int sim_container_list(const sim_container *sim, int *entries) {
+	uint32_t *stack, n = sim->root;
+	int top = 0, i = 0;
+	
+	// the tree is O(log n) deep with high probability, but an explicit stack costs nothing
+	stack = (uint32_t *) malloc(sizeof(uint32_t) * (sim->size > 0 ? sim->size : 1));
+	if(stack == NULL) {
+		return 0;
+	}
+	
+	while(n != NO_SIM_NODE || top > 0) {
+		while(n != NO_SIM_NODE) {
+			stack[top++] = n;
+			n = sim->nodes[n].left;
+		}
+		n = stack[--top];
+		entries[i++] = (int) n;
+		n = sim->nodes[n].right;
+	}
+	
+	free(stack);
+	return 1;
+}
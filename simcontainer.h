@@ -0,0 +1,32 @@
+/*
+ *  simcontainer.h
+ *  SpotifySort
+ *
+ *  An in-memory playlist container that entries can be moved around in
+ *  cheaply, for previewing a sort without touching the real one.
+ *
+ */
+
+#ifndef SIMCONTAINER_H_
+#define SIMCONTAINER_H_
+
+#include <stdint.h>
+
+typedef struct s_sim_container sim_container;
+
+/// A container of size entries, numbered 0 to size - 1 in order; NULL if out of memory
+extern sim_container *create_sim_container(int size);
+extern void free_sim_container(sim_container *sim);
+
+extern int sim_container_size(const sim_container *sim);
+
+/// The number of the entry at position index
+extern int sim_container_entry(const sim_container *sim, int index);
+
+/// Move the entry at position from so that it ends up at position to; 0 if either is out of range
+extern int sim_container_move(sim_container *sim, int from, int to);
+
+/// Write the entry numbers in container order to entries
+extern int sim_container_list(const sim_container *sim, int *entries);
+
+#endif
@@ -0,0 +1,353 @@
+/*
+ *  snapshot.c
+ *  SpotifySort
+ *
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "snapshot.h"
+#include "playlist.h"
+
+/*
+ * A snapshot is a header and then a fixed-size record for each playlist and
+ * folder, in container order, in the byte order of the machine that wrote
+ * it: it is a cache, not an archive. Playlists are known by a hash of their
+ * link and folders by their id, so both keep who they are when renamed or
+ * moved; names are only kept as hashes.
+ */
+
+#define SNAPSHOT_MAGIC "SPSORT\0\1"
+#define MAX_LINK 256
+#define NO_ENTRY ((uint32_t) -1)
+
+typedef struct s_snapshot_header {
+	char magic[8];
+	uint32_t num_entries;
+	uint32_t reserved;
+} snapshot_header;
+
+typedef struct s_snapshot_entry {
+	uint64_t id;        // hash of the playlist's link, or the folder id; 0 if unknown
+	uint64_t folder_id; // of the folder it is in; 0 at the top level
+	uint64_t name_hash;
+	uint32_t position;  // in the container
+	uint32_t type;      // SP_PLAYLIST_TYPE_PLAYLIST or SP_PLAYLIST_TYPE_START_FOLDER
+} snapshot_entry;
+
+static uint64_t hash_string(const char *s) {
+	uint64_t hash = 14695981039346656037ULL; // FNV-1a
+	
+	for(; s != NULL && *s != 0; ++s) {
+		hash = (hash ^ (unsigned char) *s) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/// The container's playlists and folders as records; NULL if out of memory
+static snapshot_entry *read_entries(sp_playlistcontainer *pc, int *num_entries) {
+	snapshot_entry *entries, *e;
+	sp_uint64 *folders; // the folders the current entry is in, innermost last
+	sp_playlist *pl;
+	sp_link *link;
+	char uri[MAX_LINK];
+	int i, num_playlists, depth = 0, count = 0;
+	
+	num_playlists = sp_playlistcontainer_num_playlists(pc);
+	entries = (snapshot_entry *) malloc(sizeof(snapshot_entry) * (num_playlists > 0 ? num_playlists : 1));
+	folders = (sp_uint64 *) malloc(sizeof(sp_uint64) * (num_playlists + 1));
+	if(entries == NULL || folders == NULL) {
+		free(entries);
+		free(folders);
+		return NULL;
+	}
+	folders[0] = 0;
+	
+	for(i = 0; i < num_playlists; ++i) {
+		e = &entries[count];
+		memset(e, 0, sizeof(snapshot_entry));
+		e->folder_id = folders[depth];
+		e->position = (uint32_t) i;
+		
+		switch(sp_playlistcontainer_playlist_type(pc, i)) {
+			case SP_PLAYLIST_TYPE_PLAYLIST:
+				pl = sp_playlistcontainer_playlist(pc, i);
+				link = pl != NULL ? sp_link_create_from_playlist(pl) : NULL;
+				if(link != NULL) {
+					if(sp_link_as_string(link, uri, sizeof(uri)) < (int) sizeof(uri)) {
+						e->id = hash_string(uri);
+					}
+					sp_link_release(link);
+				}
+				e->name_hash = pl != NULL ? hash_string(sp_playlist_name(pl)) : 0;
+				e->type = SP_PLAYLIST_TYPE_PLAYLIST;
+				++count;
+				break;
+			case SP_PLAYLIST_TYPE_START_FOLDER:
+				e->id = sp_playlistcontainer_playlist_folder_id(pc, i);
+				e->name_hash = hash_string(sp_playlistcontainer_playlist_folder_name(pc, i));
+				e->type = SP_PLAYLIST_TYPE_START_FOLDER;
+				folders[++depth] = e->id;
+				++count;
+				break;
+			case SP_PLAYLIST_TYPE_END_FOLDER:
+				if(depth > 0) {
+					--depth;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+	
+	free(folders);
+	*num_entries = count;
+	return entries;
+}
+
+/** Saving **/
+
+int save_snapshot(sp_playlistcontainer *pc, const char *path) {
+	snapshot_header header;
+	snapshot_entry *entries;
+	char *temp, *slash;
+	FILE *file;
+	int num_entries, ok, error = 0;
+	
+	// the next run takes whatever is in the snapshot to be in order
+	if(!playlists_sorted(pc)) {
+		fprintf(stderr, "WARNING: not keeping a snapshot, as the container is not sorted\n");
+		return 0;
+	}
+	
+	entries = read_entries(pc, &num_entries);
+	temp = (char *) malloc(strlen(path) + 5);
+	if(entries == NULL || temp == NULL) {
+		fprintf(stderr, "WARNING: out of memory writing the snapshot\n");
+		free(entries);
+		free(temp);
+		return 0;
+	}
+	
+	// libspotify makes its cache directory, but the snapshot may go elsewhere
+	strcpy(temp, path);
+	slash = strrchr(temp, '/');
+	if(slash != NULL && slash != temp) {
+		*slash = 0;
+		mkdir(temp, 0700);
+	}
+	
+	// written aside and renamed into place, so a run that dies leaves the old one whole
+	sprintf(temp, "%s.new", path);
+	file = fopen(temp, "wb");
+	ok = file != NULL;
+	if(ok) {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+		header.num_entries = (uint32_t) num_entries;
+		ok = fwrite(&header, sizeof(header), 1, file) == 1
+			&& fwrite(entries, sizeof(snapshot_entry), num_entries, file) == (size_t) num_entries;
+		if(fclose(file) != 0) {
+			ok = 0;
+		}
+		ok = ok && rename(temp, path) == 0;
+	}
+	if(!ok) {
+		error = errno;
+		remove(temp);
+		fprintf(stderr, "WARNING: cannot write the snapshot to %s: %s\n", path, strerror(error));
+	}
+	
+	free(temp);
+	free(entries);
+	return ok;
+}
+
+/** Comparing **/
+
+static uint32_t slot_of(uint64_t id, uint32_t table_size) {
+	return (uint32_t) ((id * 0x9E3779B97F4A7C15ULL) >> 32) & (table_size - 1);
+}
+
+/// The index of the old entry with this id and type, or NO_ENTRY
+static uint32_t find_entry(const snapshot_entry *old, const uint32_t *table, uint32_t table_size, uint64_t id, uint32_t type) {
+	uint32_t i;
+	
+	for(i = slot_of(id, table_size); table[i] != NO_ENTRY; i = (i + 1) & (table_size - 1)) {
+		if(old[table[i]].id == id && old[table[i]].type == type) {
+			return table[i];
+		}
+	}
+	return NO_ENTRY;
+}
+
+/// The entries of the snapshot at path; NULL if there is none or it will not do
+static snapshot_entry *load_entries(const char *path, int *num_entries) {
+	snapshot_header header;
+	snapshot_entry *entries = NULL;
+	FILE *file;
+	
+	file = fopen(path, "rb");
+	if(file == NULL) {
+		if(errno != ENOENT) {
+			fprintf(stderr, "WARNING: cannot read the snapshot at %s: %s\n", path, strerror(errno));
+		}
+		return NULL;
+	}
+	
+	if(fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0
+			&& header.num_entries <= INT32_MAX / sizeof(snapshot_entry)) {
+		entries = (snapshot_entry *) malloc(sizeof(snapshot_entry) * (header.num_entries > 0 ? header.num_entries : 1));
+		if(entries != NULL && (fread(entries, sizeof(snapshot_entry), header.num_entries, file) != header.num_entries || fgetc(file) != EOF)) {
+			free(entries);
+			entries = NULL;
+		}
+	}
+	fclose(file);
+	
+	if(entries == NULL) {
+		fprintf(stderr, "WARNING: ignoring the snapshot at %s, which could not be read\n", path);
+		return NULL;
+	}
+	*num_entries = (int) header.num_entries;
+	return entries;
+}
+
+/*
+ * One pass over each side, through a hash table of the old entries. An
+ * entry still in the same folder under the same name is in order if its
+ * old position comes after that of the last sibling kept, and before that
+ * of the sibling after it, if that one would do there instead: otherwise
+ * one playlist moved up a folder would unsettle all those it passed. The
+ * snapshot was sorted, so the entries kept are still in order.
+ */
+
+/// Fill the table with the old entries; 0 if folders cannot be told apart by id
+static int index_entries(const snapshot_entry *old, int num_old, uint32_t *table, uint32_t table_size) {
+	uint32_t i, j;
+	
+	memset(table, 0xff, sizeof(uint32_t) * table_size);
+	for(i = 0; i < (uint32_t) num_old; ++i) {
+		if(old[i].id == 0) {
+			if(old[i].type == SP_PLAYLIST_TYPE_START_FOLDER) {
+				return 0;
+			}
+			continue;
+		}
+		if(find_entry(old, table, table_size, old[i].id, old[i].type) != NO_ENTRY) {
+			// a playlist may be listed twice, but not a folder
+			if(old[i].type == SP_PLAYLIST_TYPE_START_FOLDER) {
+				return 0;
+			}
+			continue;
+		}
+		for(j = slot_of(old[i].id, table_size); table[j] != NO_ENTRY; j = (j + 1) & (table_size - 1));
+		table[j] = i;
+	}
+	return 1;
+}
+
+/// Link each entry to the next one in the same folder, or NO_ENTRY
+static void link_siblings(const snapshot_entry *live, int num_live, uint32_t *next, sp_uint64 *folders, uint32_t *previous) {
+	int i, depth = 0;
+	
+	folders[0] = 0;
+	previous[0] = NO_ENTRY;
+	for(i = 0; i < num_live; ++i) {
+		next[i] = NO_ENTRY;
+		while(depth > 0 && folders[depth] != live[i].folder_id) {
+			--depth;
+		}
+		if(previous[depth] != NO_ENTRY) {
+			next[previous[depth]] = (uint32_t) i;
+		}
+		previous[depth] = (uint32_t) i;
+		if(live[i].type == SP_PLAYLIST_TYPE_START_FOLDER) {
+			folders[++depth] = live[i].id;
+			previous[depth] = NO_ENTRY;
+		}
+	}
+}
+
+int diff_snapshot(sp_playlistcontainer *pc, const char *path, uint8_t **changed) {
+	snapshot_entry *old, *live = NULL, *e;
+	uint32_t *table, *next, *previous, table_size = 16, i, j, parent;
+	sp_uint64 *folders;
+	int64_t *position; // of each entry in the snapshot, if it is still in the same folder under the same name
+	int64_t *last;     // per old folder, then the top level: the old position of the last entry kept
+	int64_t following;
+	int num_old, num_live = 0, num_playlists, num_changed = 0;
+	
+	*changed = NULL;
+	old = load_entries(path, &num_old);
+	if(old == NULL) {
+		return -1;
+	}
+	
+	while(table_size < 2 * (uint32_t) num_old) {
+		table_size *= 2;
+	}
+	num_playlists = sp_playlistcontainer_num_playlists(pc);
+	table = (uint32_t *) malloc(sizeof(uint32_t) * table_size);
+	last = (int64_t *) malloc(sizeof(int64_t) * (num_old + 1));
+	position = (int64_t *) malloc(sizeof(int64_t) * (num_playlists + 1));
+	next = (uint32_t *) malloc(sizeof(uint32_t) * (num_playlists + 1));
+	previous = (uint32_t *) malloc(sizeof(uint32_t) * (num_playlists + 1));
+	folders = (sp_uint64 *) malloc(sizeof(sp_uint64) * (num_playlists + 1));
+	*changed = (uint8_t *) calloc(num_playlists > 0 ? num_playlists : 1, 1);
+	if(table != NULL && last != NULL && position != NULL && next != NULL && previous != NULL && folders != NULL && *changed != NULL) {
+		live = read_entries(pc, &num_live);
+	}
+	
+	if(live == NULL) {
+		fprintf(stderr, "WARNING: out of memory comparing with the snapshot\n");
+		num_changed = -1;
+	} else if(!index_entries(old, num_old, table, table_size)) {
+		fprintf(stderr, "WARNING: ignoring the snapshot at %s, whose folders cannot be told apart\n", path);
+		num_changed = -1;
+	} else {
+		for(i = 0; i <= (uint32_t) num_old; ++i) {
+			last[i] = -1;
+		}
+		for(i = 0; i < (uint32_t) num_live; ++i) {
+			e = &live[i];
+			j = e->id != 0 ? find_entry(old, table, table_size, e->id, e->type) : NO_ENTRY;
+			position[i] = j != NO_ENTRY && old[j].name_hash == e->name_hash && old[j].folder_id == e->folder_id ? (int64_t) old[j].position : -1;
+		}
+		link_siblings(live, num_live, next, folders, previous);
+		
+		for(i = 0; i < (uint32_t) num_live; ++i) {
+			e = &live[i];
+			if(position[i] >= 0) {
+				parent = e->folder_id == 0 ? (uint32_t) num_old : find_entry(old, table, table_size, e->folder_id, SP_PLAYLIST_TYPE_START_FOLDER);
+				following = next[i] != NO_ENTRY ? position[next[i]] : -1;
+				if(parent != NO_ENTRY && position[i] > last[parent] && !(following > last[parent] && following < position[i])) {
+					last[parent] = position[i];
+					continue;
+				}
+			}
+			(*changed)[e->position] = 1;
+			++num_changed;
+		}
+	}
+	
+	if(num_changed < 0) {
+		free(*changed);
+		*changed = NULL;
+	}
+	free(live);
+	free(folders);
+	free(previous);
+	free(next);
+	free(position);
+	free(last);
+	free(table);
+	free(old);
+	return num_changed;
+}
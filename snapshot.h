@@ -0,0 +1,34 @@
+/*
+ *  snapshot.h
+ *  SpotifySort
+ *
+ *  Remembers what a sorted container looked like, so that the next run
+ *  can tell which entries have changed since and place only those.
+ *
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include <libspotify/api.h>
+
+/**
+ * Write a snapshot of the container to path, replacing any snapshot there
+ * and creating the directory it goes in. Returns 0, having said why, if it
+ * could not be written, or if the container is not sorted: the next run
+ * would take its entries to be in order.
+ */
+extern int save_snapshot(sp_playlistcontainer *pc, const char *path);
+
+/**
+ * Compare the container with the snapshot at path. Entry i has changed,
+ * and (*changed)[i] is set, if it is new, renamed or in another folder, or
+ * out of the order the snapshot had it in among its siblings; the others
+ * are still in order. The caller frees *changed. Returns how many entries
+ * have changed, or -1 if there is no snapshot to go by.
+ */
+extern int diff_snapshot(sp_playlistcontainer *pc, const char *path, uint8_t **changed);
+
+#endif
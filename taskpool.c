@@ -0,0 +1,248 @@
+/*
+ *  taskpool.c
+ *  SpotifySort
+ *
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "taskpool.h"
+
+typedef struct s_task_deque {
+	pthread_mutex_t lock;
+	uint32_t *tasks;
+	int top;    // next task to steal
+	int bottom; // one past the owner's next task
+	int capacity;
+} task_deque;
+
+typedef struct s_worker {
+	task_pool *pool;
+	int id;
+} worker;
+
+struct s_task_pool {
+	task_function run;
+	void *context;
+	
+	int num_workers;
+	task_deque *deques;
+	worker *workers;
+	
+	// idle workers sleep on wake; pending counts queued and running tasks
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	int num_idle;
+	int pending;
+};
+
+/** Deque operations **/
+
+static int deque_push(task_deque *d, uint32_t task) {
+	uint32_t *tasks;
+	
+	pthread_mutex_lock(&d->lock);
+	
+	if(d->bottom == d->capacity) {
+		if(d->top > 0) {
+			// reuse the space stolen from the top
+			d->bottom -= d->top;
+			memmove(d->tasks, d->tasks + d->top, sizeof(uint32_t) * d->bottom);
+			d->top = 0;
+		} else {
+			tasks = (uint32_t *) realloc(d->tasks, sizeof(uint32_t) * d->capacity * 2);
+			if(tasks == NULL) {
+				pthread_mutex_unlock(&d->lock);
+				return 0;
+			}
+			d->tasks = tasks;
+			d->capacity *= 2;
+		}
+	}
+	d->tasks[d->bottom++] = task;
+	
+	pthread_mutex_unlock(&d->lock);
+	return 1;
+}
+
+static int deque_pop(task_deque *d, uint32_t *task) {
+	int found = 0;
+	
+	pthread_mutex_lock(&d->lock);
+	if(d->bottom > d->top) {
+		*task = d->tasks[--d->bottom];
+		found = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+	
+	return found;
+}
+
+static int deque_steal(task_deque *d, uint32_t *task) {
+	int found = 0;
+	
+	pthread_mutex_lock(&d->lock);
+	if(d->bottom > d->top) {
+		*task = d->tasks[d->top++];
+		found = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+	
+	return found;
+}
+
+/** Workers **/
+
+static int find_task(task_pool *pool, int id, uint32_t *task) {
+	int i;
+	
+	if(deque_pop(&pool->deques[id], task)) {
+		return 1;
+	}
+	
+	for(i = 1; i < pool->num_workers; ++i) {
+		if(deque_steal(&pool->deques[(id + i) % pool->num_workers], task)) {
+			return 1;
+		}
+	}
+	
+	return 0;
+}
+
+static void *run_worker(void *arg) {
+	worker *w = (worker *) arg;
+	task_pool *pool = w->pool;
+	uint32_t task;
+	int found;
+	
+	for(;;) {
+		found = find_task(pool, w->id, &task);
+		
+		if(!found) {
+			// look again under the pool lock, so a push cannot slip in before we sleep
+			pthread_mutex_lock(&pool->lock);
+			++pool->num_idle;
+			while(__sync_fetch_and_add(&pool->pending, 0) > 0 && !(found = find_task(pool, w->id, &task))) {
+				pthread_cond_wait(&pool->wake, &pool->lock);
+			}
+			--pool->num_idle;
+			pthread_mutex_unlock(&pool->lock);
+			
+			if(!found) {
+				break;
+			}
+		}
+		
+		pool->run(pool->context, task, w->id);
+		
+		if(__sync_sub_and_fetch(&pool->pending, 1) == 0) {
+			pthread_mutex_lock(&pool->lock);
+			pthread_cond_broadcast(&pool->wake);
+			pthread_mutex_unlock(&pool->lock);
+		}
+	}
+	
+	return NULL;
+}
+
+/** Pool operations **/
+
+task_pool *create_task_pool(int num_workers, task_function run, void *context) {
+	task_pool *pool;
+	int i, count = num_workers > 0 ? num_workers : 1;
+	
+	pool = (task_pool *) calloc(1, sizeof(task_pool));
+	if(pool == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	
+	pool->run = run;
+	pool->context = context;
+	pool->deques = (task_deque *) calloc(count, sizeof(task_deque));
+	pool->workers = (worker *) calloc(count, sizeof(worker));
+	if(pool->deques == NULL || pool->workers == NULL) {
+		free_task_pool(pool);
+		return NULL;
+	}
+	
+	// num_workers counts the deques set up so far, which is what free_task_pool() undoes
+	for(i = 0; i < count; ++i) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+		
+		pthread_mutex_init(&pool->deques[i].lock, NULL);
+		pool->num_workers = i + 1;
+		pool->deques[i].capacity = 64;
+		pool->deques[i].tasks = (uint32_t *) malloc(sizeof(uint32_t) * pool->deques[i].capacity);
+		if(pool->deques[i].tasks == NULL) {
+			free_task_pool(pool);
+			return NULL;
+		}
+	}
+	
+	return pool;
+}
+
+void free_task_pool(task_pool *pool) {
+	int i;
+	
+	for(i = 0; i < pool->num_workers; ++i) {
+		pthread_mutex_destroy(&pool->deques[i].lock);
+		free(pool->deques[i].tasks);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->wake);
+	free(pool->deques);
+	free(pool->workers);
+	free(pool);
+}
+
+void task_pool_push(task_pool *pool, int worker, uint32_t task) {
+	__sync_add_and_fetch(&pool->pending, 1);
+	
+	if(!deque_push(&pool->deques[worker], task)) {
+		// out of memory: run it here instead
+		pool->run(pool->context, task, worker);
+		__sync_sub_and_fetch(&pool->pending, 1);
+		return;
+	}
+	
+	pthread_mutex_lock(&pool->lock);
+	if(pool->num_idle > 0) {
+		pthread_cond_signal(&pool->wake);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int task_pool_run(task_pool *pool, uint32_t task) {
+	pthread_t *threads;
+	int i, started = 0;
+	
+	threads = (pthread_t *) malloc(sizeof(pthread_t) * pool->num_workers);
+	if(threads == NULL) {
+		return 0;
+	}
+	
+	task_pool_push(pool, 0, task);
+	
+	for(i = 1; i < pool->num_workers; ++i) {
+		if(pthread_create(&threads[i], NULL, run_worker, &pool->workers[i]) == 0) {
+			++started;
+		} else {
+			break;
+		}
+	}
+	
+	run_worker(&pool->workers[0]);
+	
+	for(i = 1; i <= started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	
+	free(threads);
+	return 1;
+}
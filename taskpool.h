@@ -0,0 +1,30 @@
+/*
+ *  taskpool.h
+ *  SpotifySort
+ *
+ *  A small work-stealing pool of threads. Each worker owns a deque of
+ *  tasks: it pushes and pops at one end, idle workers steal from the other.
+ *  Tasks are plain 32-bit ids interpreted by the task function.
+ *
+ */
+
+#ifndef TASKPOOL_H_
+#define TASKPOOL_H_
+
+#include <stdint.h>
+
+typedef struct s_task_pool task_pool;
+
+/// Runs one task on the given worker (0 is the calling thread)
+typedef void (*task_function)(void *context, uint32_t task, int worker);
+
+extern task_pool *create_task_pool(int num_workers, task_function run, void *context);
+extern void free_task_pool(task_pool *pool);
+
+/// Queue a task from inside a running task on the given worker
+extern void task_pool_push(task_pool *pool, int worker, uint32_t task);
+
+/// Run the first task and everything it pushes; returns when all are done
+extern int task_pool_run(task_pool *pool, uint32_t task);
+
+#endif
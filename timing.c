@@ -0,0 +1,109 @@
+/*
+ *  timing.c
+ *  SpotifySort
+ *
+ */
+
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#include "timing.h"
+
+uint64_t monotonic_ns(void) {
+#ifdef __APPLE__
+	static mach_timebase_info_data_t timebase;
+	
+	if(timebase.denom == 0) {
+		mach_timebase_info(&timebase);
+	}
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+static uint64_t timeval_ns(const struct timeval *tv) {
+	return (uint64_t) tv->tv_sec * 1000000000ULL + (uint64_t) tv->tv_usec * 1000;
+}
+
+uint64_t process_cpu_ns(void) {
+	struct rusage usage;
+	
+	if(getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+	return timeval_ns(&usage.ru_utime) + timeval_ns(&usage.ru_stime);
+}
+
+long peak_rss_kb(void) {
+	struct rusage usage;
+	
+	if(getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024; // bytes on Mac OS X
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+/** Phases **/
+
+void start_stopwatch(stopwatch *watch) {
+	watch->wall_ns = monotonic_ns();
+	watch->cpu_ns = process_cpu_ns();
+}
+
+void stop_phase(stopwatch *watch, phase_report *phase) {
+	stopwatch now;
+	
+	start_stopwatch(&now);
+	if(phase != NULL) {
+		phase->wall_ns += now.wall_ns - watch->wall_ns;
+		phase->cpu_ns += now.cpu_ns - watch->cpu_ns;
+		phase->peak_rss_kb = peak_rss_kb();
+	}
+	*watch = now;
+}
+
+static double ms(uint64_t ns) {
+	return ns / 1000000.0;
+}
+
+void print_phase(FILE *file, const char *name, const phase_report *phase) {
+	if(phase == NULL) {
+		fprintf(file, "%-10s %12s %12s %14s\n", "phase", "wall ms", "cpu ms", "peak RSS kB");
+	} else {
+		fprintf(file, "%-10s %12.1f %12.1f %14ld\n", name, ms(phase->wall_ns), ms(phase->cpu_ns), phase->peak_rss_kb);
+	}
+}
+
+static int compare_durations(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	
+	return x < y ? -1 : x > y;
+}
+
+void sort_durations(uint64_t *durations, int count) {
+	qsort(durations, count, sizeof(uint64_t), compare_durations);
+}
+
+double percentile_ms(const uint64_t *sorted, int count, int percent) {
+	int i = (count * percent + 99) / 100 - 1; // nearest rank
+	
+	return count > 0 ? ms(sorted[i < 0 ? 0 : i]) : 0.0;
+}
+
+void write_phase_json(FILE *file, const char *name, const phase_report *phase) {
+	fprintf(file, "\"%s\": { \"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"peak_rss_kb\": %ld }",
+			name, ms(phase->wall_ns), ms(phase->cpu_ns), phase->peak_rss_kb);
+}
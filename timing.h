@@ -0,0 +1,53 @@
+/*
+ *  timing.h
+ *  SpotifySort
+ *
+ *  Clock and memory readings for reporting where a run spends its time.
+ *
+ */
+
+#ifndef TIMING_H_
+#define TIMING_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/// Time and memory spent in one phase of a run
+typedef struct s_phase_report {
+	uint64_t wall_ns;
+	uint64_t cpu_ns;  // on all threads, libspotify's included
+	long peak_rss_kb; // at the end of the phase
+} phase_report;
+
+typedef struct s_stopwatch {
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+} stopwatch;
+
+/// Nanoseconds on a clock that never jumps; only differences mean anything
+extern uint64_t monotonic_ns(void);
+
+/// CPU time used by the process so far, in nanoseconds
+extern uint64_t process_cpu_ns(void);
+
+/// Largest resident set size of the process so far, in kilobytes
+extern long peak_rss_kb(void);
+
+extern void start_stopwatch(stopwatch *watch);
+
+/// Charge the time since the stopwatch was started or last stopped to phase, and restart it
+extern void stop_phase(stopwatch *watch, phase_report *phase);
+
+/// Sort durations in nanoseconds, ready for percentile_ms()
+extern void sort_durations(uint64_t *durations, int count);
+
+/// The nearest-rank percentile of sorted durations in milliseconds; 0 if there are none
+extern double percentile_ms(const uint64_t *sorted, int count, int percent);
+
+/// One line of a table of phases; NULL phase prints the header
+extern void print_phase(FILE *file, const char *name, const phase_report *phase);
+
+/// The phase as a JSON member, without a trailing comma
+extern void write_phase_json(FILE *file, const char *name, const phase_report *phase);
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ *  trace.c
+ *  SpotifySort
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+#include "timing.h"
+
+/*
+ * Events are written as they happen, under one lock since folders are
+ * sorted on several threads and libspotify calls back on its own. Threads
+ * are numbered in the order they first trace something.
+ */
+
+static FILE *g_trace;
+static pthread_mutex_t g_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t g_trace_start;
+static int g_trace_events;
+static int g_trace_threads;
+
+static pthread_key_t g_thread_key;
+static pthread_once_t g_thread_key_once = PTHREAD_ONCE_INIT;
+
+static void create_thread_key(void) {
+	pthread_key_create(&g_thread_key, NULL);
+}
+
+/// Start the next event; the trace lock must be held
+static void begin_event(void) {
+	fprintf(g_trace, g_trace_events++ > 0 ? ",\n" : "\n");
+}
+
+static void write_string(const char *s) {
+	fputc('"', g_trace);
+	for(; *s != '\0'; ++s) {
+		if(*s == '"' || *s == '\\') {
+			fputc('\\', g_trace);
+			fputc(*s, g_trace);
+		} else if((unsigned char) *s < 0x20) {
+			fprintf(g_trace, "\\u%04x", (unsigned char) *s);
+		} else {
+			fputc(*s, g_trace);
+		}
+	}
+	fputc('"', g_trace);
+}
+
+/// The calling thread's number; the trace lock must be held
+static int thread_id(void) {
+	intptr_t id;
+	
+	pthread_once(&g_thread_key_once, create_thread_key);
+	id = (intptr_t) pthread_getspecific(g_thread_key);
+	if(id == 0) {
+		id = ++g_trace_threads;
+		pthread_setspecific(g_thread_key, (void *) id);
+	}
+	return (int) id;
+}
+
+static double trace_us(uint64_t ns) {
+	return ns >= g_trace_start ? (ns - g_trace_start) / 1000.0 : 0.0;
+}
+
+int open_trace(const char *path) {
+	FILE *file = fopen(path, "w");
+	
+	if(file == NULL) {
+		return 0;
+	}
+	
+	pthread_mutex_lock(&g_trace_mutex);
+	g_trace = file;
+	g_trace_start = monotonic_ns();
+	g_trace_events = 0;
+	fprintf(g_trace, "[");
+	pthread_mutex_unlock(&g_trace_mutex);
+	
+	return 1;
+}
+
+void close_trace(void) {
+	pthread_mutex_lock(&g_trace_mutex);
+	if(g_trace != NULL) {
+		fprintf(g_trace, "\n]\n");
+		fclose(g_trace);
+		g_trace = NULL;
+	}
+	pthread_mutex_unlock(&g_trace_mutex);
+}
+
+int tracing(void) {
+	return g_trace != NULL;
+}
+
+void trace_thread_name(const char *name) {
+	if(g_trace == NULL) {
+		return;
+	}
+	
+	pthread_mutex_lock(&g_trace_mutex);
+	if(g_trace != NULL) {
+		begin_event();
+		fprintf(g_trace, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", thread_id());
+		write_string(name);
+		fprintf(g_trace, "}}");
+	}
+	pthread_mutex_unlock(&g_trace_mutex);
+}
+
+void trace_span(const char *category, const char *name, uint64_t start_ns, uint64_t end_ns) {
+	if(g_trace == NULL) {
+		return;
+	}
+	
+	pthread_mutex_lock(&g_trace_mutex);
+	if(g_trace != NULL) {
+		begin_event();
+		fprintf(g_trace, "{\"name\":");
+		write_string(name);
+		fprintf(g_trace, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+				category, trace_us(start_ns), (end_ns - start_ns) / 1000.0, thread_id());
+	}
+	pthread_mutex_unlock(&g_trace_mutex);
+}
+
+void trace_marker(const char *category, const char *name) {
+	uint64_t now;
+	
+	if(g_trace == NULL) {
+		return;
+	}
+	
+	pthread_mutex_lock(&g_trace_mutex);
+	if(g_trace != NULL) {
+		now = monotonic_ns();
+		begin_event();
+		fprintf(g_trace, "{\"name\":");
+		write_string(name);
+		fprintf(g_trace, ",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+				category, trace_us(now), thread_id());
+	}
+	pthread_mutex_unlock(&g_trace_mutex);
+}
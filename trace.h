@@ -0,0 +1,33 @@
+/*
+ *  trace.h
+ *  SpotifySort
+ *
+ *  Writes what a run does as trace events (the JSON format read by
+ *  chrome://tracing and Perfetto), so the sort, the moves and the main
+ *  loop can be seen on one timeline. Every call does nothing until a
+ *  trace is opened.
+ *
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+/// Start writing events to path; 0 if it cannot be written
+extern int open_trace(const char *path);
+extern void close_trace(void);
+
+/// Whether a trace is open, so callers can skip reading the clock
+extern int tracing(void);
+
+/// Name the calling thread in the trace
+extern void trace_thread_name(const char *name);
+
+/// Something that ran from start_ns to end_ns on the monotonic_ns() clock
+extern void trace_span(const char *category, const char *name, uint64_t start_ns, uint64_t end_ns);
+
+/// Something that happened now
+extern void trace_marker(const char *category, const char *name);
+
+#endif